@@ -0,0 +1,235 @@
+#ifndef Ntuplizer_AsyncTreeWriter_h
+#define Ntuplizer_AsyncTreeWriter_h
+
+// Background thread doing TTree::Fill (and therefore the basket compression and writing)
+// for trees filled by the analyzer.
+//
+// attach() rebinds the branches of a tree to buffers owned by the writer and remembers the
+// analyzer buffers they were bound to. push() copies the current content of the analyzer
+// buffers (only the used part of the arrays) into one of queueDepth slots and hands it to the
+// writer thread, blocking while all the slots are in use. Entries are filled in the order
+// they were pushed, for all the attached trees. Anything else touching the output file from
+// the analyzer thread must be preceded by drain().
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "TBranch.h"
+#include "TLeaf.h"
+#include "TObjArray.h"
+#include "TTree.h"
+
+namespace async {
+
+class AsyncTreeWriter {
+   public:
+    AsyncTreeWriter(unsigned int queueDepth, int maxArrayLength)
+        : maxArrayLength_(maxArrayLength), slots_(std::max(queueDepth, 1u)) {
+        for (auto& slot : slots_) { free_.push_back(&slot); }
+        thread_ = std::thread(&AsyncTreeWriter::run, this);
+    }
+
+    ~AsyncTreeWriter() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        filled_cv_.notify_all();
+        thread_.join();
+    }
+
+    // Take over the branches of the tree (booked on the analyzer buffers)
+    void attach(TTree* tree) {
+        Tree attached;
+        attached.tree = tree;
+        size_t offset = 0;
+        TObjArray* leaves = tree->GetListOfLeaves();
+        for (int i = 0; i < leaves->GetEntriesFast(); i++) {
+            TLeaf* leaf = static_cast<TLeaf*>(leaves->At(i));
+            Field field;
+            field.source = static_cast<const char*>(leaf->GetValuePointer());
+            field.size = leaf->GetLenType();
+            if (TLeaf* count = leaf->GetLeafCount()) {
+                field.counter = static_cast<const Int_t*>(count->GetValuePointer());
+                field.length = leaf->GetLenStatic();
+                field.capacity = size_t(maxArrayLength_) * field.length * field.size;
+            } else {
+                field.length = leaf->GetLen();
+                field.capacity = size_t(field.length) * field.size;
+            }
+            field.offset = offset;
+            offset += field.capacity;
+            attached.fields.push_back(field);
+        }
+        attached.buffer.resize(offset);
+        for (size_t i = 0; i < attached.fields.size(); i++) {
+            TLeaf* leaf = static_cast<TLeaf*>(leaves->At(i));
+            leaf->GetBranch()->SetAddress(attached.buffer.data() + attached.fields[i].offset);
+        }
+        attached.zipBytes = 0;
+        std::lock_guard<std::mutex> lock(mutex_);
+        trees_.push_back(std::move(attached));
+    }
+
+    // Forget the attached trees (before their file is closed)
+    void detachAll() {
+        drain();
+        trees_.clear();
+    }
+
+    // Snapshot the analyzer buffers of the tree and queue the entry
+    void push(const TTree* tree) {
+        rethrow();
+        size_t index = 0;
+        while (trees_[index].tree != tree) { index++; }
+        Slot* slot = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (free_.empty()) {
+                auto start = std::chrono::steady_clock::now();
+                free_cv_.wait(lock, [this] { return !free_.empty(); });
+                stallSeconds_ +=
+                    std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            }
+            slot = free_.front();
+            free_.pop_front();
+        }
+        // Counters are copied first, the arrays are copied up to their current length
+        const Tree& attached = trees_[index];
+        slot->tree = index;
+        slot->buffer.resize(attached.buffer.size());
+        for (const auto& field : attached.fields) {
+            size_t bytes = field.counter ? size_t(std::min(*field.counter, maxArrayLength_)) *
+                                               field.length * field.size
+                                         : field.capacity;
+            std::memcpy(slot->buffer.data() + field.offset, field.source, bytes);
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            filled_.push_back(slot);
+            size_t depth = filled_.size() + (busy_ ? 1 : 0);
+            maxDepth_ = std::max(maxDepth_, depth);
+            sumDepth_ += depth;
+            nPushed_++;
+        }
+        filled_cv_.notify_one();
+    }
+
+    // Wait until all the queued entries are filled
+    void drain() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        free_cv_.wait(lock, [this] { return filled_.empty() && !busy_; });
+        lock.unlock();
+        rethrow();
+    }
+
+    // Compressed bytes written so far for the attached trees
+    Long64_t zipBytes() const {
+        Long64_t bytes = 0;
+        for (const auto& attached : trees_) { bytes += attached.zipBytes; }
+        return bytes;
+    }
+
+    Long64_t nPushed() const { return nPushed_; }
+    size_t maxDepth() const { return maxDepth_; }
+    double meanDepth() const { return nPushed_ ? double(sumDepth_) / nPushed_ : 0.; }
+    double stallSeconds() const { return stallSeconds_; }
+
+   private:
+    struct Field {
+        const char* source = nullptr;  // analyzer buffer
+        const Int_t* counter = nullptr;
+        int length = 1;
+        size_t size = 0;
+        size_t capacity = 0;
+        size_t offset = 0;  // in the writer and slot buffers
+    };
+
+    struct Tree {
+        TTree* tree = nullptr;
+        std::vector<Field> fields;
+        std::vector<char> buffer;  // the branches are bound to this buffer
+        std::atomic<Long64_t> zipBytes{0};
+
+        Tree() = default;
+        Tree(Tree&& other)
+            : tree(other.tree),
+              fields(std::move(other.fields)),
+              buffer(std::move(other.buffer)),
+              zipBytes(other.zipBytes.load()) {}
+    };
+
+    struct Slot {
+        size_t tree = 0;
+        std::vector<char> buffer;
+    };
+
+    void run() {
+        while (true) {
+            Slot* slot = nullptr;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                filled_cv_.wait(lock, [this] { return stop_ || !filled_.empty(); });
+                if (filled_.empty()) { return; }
+                slot = filled_.front();
+                filled_.pop_front();
+                busy_ = true;
+            }
+            try {
+                Tree& attached = trees_[slot->tree];
+                std::memcpy(attached.buffer.data(), slot->buffer.data(), attached.buffer.size());
+                attached.tree->Fill();
+                attached.zipBytes = attached.tree->GetZipBytes();
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (!error_) { error_ = std::current_exception(); }
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                free_.push_back(slot);
+                busy_ = false;
+            }
+            free_cv_.notify_all();
+        }
+    }
+
+    // Report an exception thrown in the writer thread to the analyzer thread
+    void rethrow() {
+        std::exception_ptr error;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::swap(error, error_);
+        }
+        if (error) { std::rethrow_exception(error); }
+    }
+
+    const Int_t maxArrayLength_;
+    std::vector<Slot> slots_;
+    std::deque<Tree> trees_;
+    std::deque<Slot*> free_;
+    std::deque<Slot*> filled_;
+    bool busy_ = false;
+    bool stop_ = false;
+    std::exception_ptr error_;
+    std::mutex mutex_;
+    std::condition_variable free_cv_;
+    std::condition_variable filled_cv_;
+    std::thread thread_;
+
+    Long64_t nPushed_ = 0;
+    size_t maxDepth_ = 0;
+    Long64_t sumDepth_ = 0;
+    double stallSeconds_ = 0.;
+};
+
+}  // namespace async
+
+#endif
@@ -0,0 +1,212 @@
+#ifndef Ntuplizer_ColumnarWriter_h
+#define Ntuplizer_ColumnarWriter_h
+
+// Flat columnar export of a TTree for readers without ROOT.
+//
+// Every leaf of the tree is written to <directory>/<column>.bin as raw little-endian values,
+// one value per entry for scalars and the concatenated values for arrays. Arrays sized by a
+// counter leaf (e.g. dmu_*[ndmu]) share the <counter>.offsets file, holding nEntries + 1
+// uint64 offsets into the concatenated values. schema.json describes the columns and is
+// rewritten after every chunk, so the files can be memory mapped (numpy.memmap, mmap) with
+// no conversion while the job is still running, up to the nEntries it declares.
+
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+#include "TLeaf.h"
+#include "TObjArray.h"
+#include "TTree.h"
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__,
+              "the columnar export writes the host byte order, which must be little-endian");
+
+namespace columnar {
+
+struct Column {
+    std::string name;
+    std::string dtype;              // numpy type string
+    size_t size = 0;                // bytes per value
+    const char* address = nullptr;  // buffer bound to the branch
+    const Int_t* counter = nullptr;
+    std::string counterName;
+    int length = 1;  // values per entry (per counter unit for jagged columns)
+    uint64_t nValues = 0;
+    std::vector<char> buffer;
+};
+
+struct Offsets {
+    std::string counterName;
+    const Int_t* counter = nullptr;
+    uint64_t last = 0;
+    std::vector<uint64_t> buffer;
+};
+
+// numpy type string and size of a ROOT leaf type, empty if not supported
+inline std::string dtypeOf(const std::string& typeName, size_t& size) {
+    static const std::map<std::string, std::pair<std::string, size_t>> types = {
+        {"Float_t", {"<f4", 4}},   {"Float16_t", {"<f4", 4}}, {"Double_t", {"<f8", 8}},
+        {"Double32_t", {"<f8", 8}}, {"Int_t", {"<i4", 4}},     {"UInt_t", {"<u4", 4}},
+        {"Short_t", {"<i2", 2}},   {"UShort_t", {"<u2", 2}},  {"Char_t", {"|i1", 1}},
+        {"UChar_t", {"|u1", 1}},   {"Bool_t", {"|b1", 1}},    {"Long64_t", {"<i8", 8}},
+        {"ULong64_t", {"<u8", 8}}};
+    auto it = types.find(typeName);
+    if (it == types.end()) { return ""; }
+    size = it->second.second;
+    return it->second.first;
+}
+
+class ColumnarWriter {
+   public:
+    ColumnarWriter(const std::string& directory, double chunkMB)
+        : directory_(directory), chunkBytes_(chunkMB * 1024 * 1024) {}
+
+    ~ColumnarWriter() { close(); }
+
+    // Build the columns from the leaves of the tree. The branch addresses must stay valid
+    // (and the same for the trees booked after an output rollover) for the whole job
+    void bind(const TTree* tree) {
+        for (size_t slash = directory_.find('/', 1); slash != std::string::npos;
+             slash = directory_.find('/', slash + 1)) {
+            mkdir(directory_.substr(0, slash).c_str(), 0755);
+        }
+        mkdir(directory_.c_str(), 0755);
+        treeName_ = tree->GetName();
+        TObjArray* leaves = tree->GetListOfLeaves();
+        for (int i = 0; i < leaves->GetEntriesFast(); i++) {
+            TLeaf* leaf = static_cast<TLeaf*>(leaves->At(i));
+            Column column;
+            column.name = leaf->GetName();
+            column.dtype = dtypeOf(leaf->GetTypeName(), column.size);
+            if (column.dtype.empty()) {
+                std::cout << "ColumnarWriter: skipping " << column.name << " of type "
+                          << leaf->GetTypeName() << std::endl;
+                continue;
+            }
+            column.address = static_cast<const char*>(leaf->GetValuePointer());
+            if (TLeaf* count = leaf->GetLeafCount()) {
+                column.counterName = count->GetName();
+                column.counter = static_cast<const Int_t*>(count->GetValuePointer());
+                column.length = leaf->GetLenStatic();
+                addOffsets(column.counterName, column.counter);
+            } else {
+                column.length = leaf->GetLen();
+            }
+            std::remove(path(column.name + ".bin").c_str());
+            columns_.push_back(column);
+        }
+    }
+
+    // Append the current values of all the columns
+    void fill() {
+        for (auto& column : columns_) {
+            uint64_t n = column.counter ? uint64_t(*column.counter) * column.length : column.length;
+            column.buffer.insert(column.buffer.end(), column.address,
+                                 column.address + n * column.size);
+            column.nValues += n;
+            buffered_ += n * column.size;
+        }
+        for (auto& offsets : offsets_) {
+            offsets.last += *offsets.counter;
+            offsets.buffer.push_back(offsets.last);
+            buffered_ += sizeof(uint64_t);
+        }
+        nEntries_++;
+        if (buffered_ >= chunkBytes_) { flush(); }
+    }
+
+    // Write the buffered chunk and the schema describing everything written so far
+    void flush() {
+        for (auto& column : columns_) {
+            append(column.name + ".bin", column.buffer.data(), column.buffer.size());
+            column.buffer.clear();
+        }
+        for (auto& offsets : offsets_) {
+            append(offsets.counterName + ".offsets", offsets.buffer.data(),
+                   offsets.buffer.size() * sizeof(uint64_t));
+            offsets.buffer.clear();
+        }
+        buffered_ = 0;
+        writeSchema();
+    }
+
+    void close() {
+        if (closed_ || treeName_.empty()) { return; }
+        flush();
+        closed_ = true;
+    }
+
+   private:
+    std::string path(const std::string& file) const { return directory_ + "/" + file; }
+
+    void addOffsets(const std::string& counterName, const Int_t* counter) {
+        for (const auto& offsets : offsets_) {
+            if (offsets.counterName == counterName) { return; }
+        }
+        Offsets offsets;
+        offsets.counterName = counterName;
+        offsets.counter = counter;
+        offsets.buffer.push_back(0);
+        std::remove(path(counterName + ".offsets").c_str());
+        offsets_.push_back(offsets);
+    }
+
+    void append(const std::string& file, const void* data, size_t size) {
+        FILE* out = std::fopen(path(file).c_str(), "ab");
+        if (!out) {
+            std::cout << "ColumnarWriter: cannot open " << path(file) << std::endl;
+            return;
+        }
+        std::fwrite(data, 1, size, out);
+        std::fclose(out);
+    }
+
+    // The schema is replaced atomically so that readers never see a partial one
+    void writeSchema() const {
+        std::string tmp = path("schema.json.tmp");
+        FILE* out = std::fopen(tmp.c_str(), "w");
+        if (!out) { return; }
+        std::fprintf(out, "{\n  \"format\": \"flat-columnar\",\n  \"version\": 1,\n");
+        std::fprintf(out, "  \"byteOrder\": \"little\",\n  \"tree\": \"%s\",\n", treeName_.c_str());
+        std::fprintf(out, "  \"nEntries\": %llu,\n", (unsigned long long)nEntries_);
+        std::fprintf(out, "  \"columns\": [\n");
+        for (size_t i = 0; i < columns_.size(); i++) {
+            const Column& column = columns_[i];
+            std::string counter = column.counter ? "\"" + column.counterName + "\"" : "null";
+            std::fprintf(out,
+                         "    {\"name\": \"%s\", \"dtype\": \"%s\", \"file\": \"%s.bin\", "
+                         "\"length\": %d, \"counter\": %s, \"nValues\": %llu}%s\n",
+                         column.name.c_str(), column.dtype.c_str(), column.name.c_str(),
+                         column.length, counter.c_str(), (unsigned long long)column.nValues,
+                         i + 1 < columns_.size() ? "," : "");
+        }
+        std::fprintf(out, "  ],\n  \"offsets\": [\n");
+        for (size_t i = 0; i < offsets_.size(); i++) {
+            const std::string& name = offsets_[i].counterName;
+            std::fprintf(out,
+                         "    {\"counter\": \"%s\", \"dtype\": \"<u8\", "
+                         "\"file\": \"%s.offsets\"}%s\n",
+                         name.c_str(), name.c_str(), i + 1 < offsets_.size() ? "," : "");
+        }
+        std::fprintf(out, "  ]\n}\n");
+        std::fclose(out);
+        std::rename(tmp.c_str(), path("schema.json").c_str());
+    }
+
+    std::string directory_;
+    double chunkBytes_;
+    std::string treeName_;
+    std::vector<Column> columns_;
+    std::vector<Offsets> offsets_;
+    uint64_t nEntries_ = 0;
+    double buffered_ = 0;
+    bool closed_ = false;
+};
+
+}  // namespace columnar
+
+#endif
@@ -0,0 +1,194 @@
+#ifndef Ntuplizer_PrecisionPolicy_h
+#define Ntuplizer_PrecisionPolicy_h
+
+// Per-branch storage precision policies for the ntuple schema.
+//
+//  - "full"     : store as booked (Float_t / Int_t)
+//  - "float16"  : Float16_t packed into nbits over [min, max] (values are clamped)
+//  - "truncate" : Float16_t with the mantissa truncated to nbits (8 bit exponent kept)
+//  - "int8", "int16", "bool" : narrow the value to Char_t / Short_t / bool
+//
+// quantize() reproduces what ROOT writes to disk (TBufferFile::WriteFloat16), so the
+// quantization error reported at the end of the job is the one seen by the readers.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace precision {
+
+enum class Kind { Full, Float16, Truncate, Int8, Int16, Bool };
+
+struct Policy {
+    Kind kind = Kind::Full;
+    double min = 0.;
+    double max = 0.;
+    int nbits = 0;
+};
+
+inline bool parseKind(const std::string& name, Kind& kind) {
+    if (name == "full") {
+        kind = Kind::Full;
+    } else if (name == "float16") {
+        kind = Kind::Float16;
+    } else if (name == "truncate") {
+        kind = Kind::Truncate;
+    } else if (name == "int8") {
+        kind = Kind::Int8;
+    } else if (name == "int16") {
+        kind = Kind::Int16;
+    } else if (name == "bool") {
+        kind = Kind::Bool;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+inline bool isNarrowing(const Policy& policy) {
+    return policy.kind == Kind::Int8 || policy.kind == Kind::Int16 || policy.kind == Kind::Bool;
+}
+
+// Size in memory of one narrowed value
+inline size_t narrowSize(const Policy& policy) {
+    switch (policy.kind) {
+        case Kind::Int8: return sizeof(int8_t);
+        case Kind::Int16: return sizeof(int16_t);
+        case Kind::Bool: return sizeof(bool);
+        default: return 0;
+    }
+}
+
+// Bytes written per value by ROOT (TBufferFile::WriteFloat16 writes the packed value of
+// float16 as a 32 bit integer, and exponent + 16 bit mantissa for truncate)
+inline size_t storedSize(const Policy& policy) {
+    switch (policy.kind) {
+        case Kind::Truncate: return 3;
+        case Kind::Int8: return sizeof(int8_t);
+        case Kind::Int16: return sizeof(int16_t);
+        case Kind::Bool: return sizeof(bool);
+        default: return 4;
+    }
+}
+
+// Leaf type to be used in the TTree leaflist ("F", "f[0,1,12]", "B", ...)
+inline std::string leafType(const Policy& policy, char bookedType) {
+    switch (policy.kind) {
+        case Kind::Float16:
+            return "f[" + std::to_string(policy.min) + "," + std::to_string(policy.max) + "," +
+                   std::to_string(policy.nbits) + "]";
+        case Kind::Truncate: return "f[0,0," + std::to_string(policy.nbits) + "]";
+        case Kind::Int8: return "B";
+        case Kind::Int16: return "S";
+        case Kind::Bool: return "O";
+        default: return std::string(1, bookedType);
+    }
+}
+
+// Check that the policy can be represented on disk, returns an error message otherwise
+inline std::string validate(const Policy& policy) {
+    if (policy.kind == Kind::Float16) {
+        if (!(policy.max > policy.min)) { return "float16 policy needs max > min"; }
+        if (policy.nbits < 2 || policy.nbits > 32) {
+            return "float16 policy needs 2 <= nbits <= 32";
+        }
+    }
+    if (policy.kind == Kind::Truncate && (policy.nbits < 2 || policy.nbits > 14)) {
+        return "truncate policy needs 2 <= nbits <= 14";
+    }
+    return "";
+}
+
+// Value read back from disk after storing x with the given policy
+inline double quantize(const Policy& policy, double x) {
+    switch (policy.kind) {
+        case Kind::Float16: {
+            double bigint = policy.nbits < 32 ? double(1u << policy.nbits) : 4294967295.;
+            double factor = bigint / (policy.max - policy.min);
+            double clamped = std::min(std::max(x, policy.min), policy.max);
+            uint32_t aint = uint32_t(0.5 + factor * (clamped - policy.min));
+            return aint / factor + policy.min;
+        }
+        case Kind::Truncate: {
+            float value = x;
+            uint32_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            const int nbits = policy.nbits;
+            uint32_t exponent = 0xff & ((bits << 1) >> 24);
+            uint32_t mantissa = ((1u << (nbits + 1)) - 1) & (bits >> (23 - nbits - 1));
+            mantissa = (mantissa + 1) >> 1;
+            if (mantissa & (1u << nbits)) { mantissa = (1u << nbits) - 1; }
+            bits = (exponent << 23) | (mantissa << (23 - nbits));
+            std::memcpy(&value, &bits, sizeof(value));
+            return x < 0 ? -value : value;
+        }
+        case Kind::Int8:
+            return std::min(std::max(std::round(x), double(std::numeric_limits<int8_t>::min())),
+                            double(std::numeric_limits<int8_t>::max()));
+        case Kind::Int16:
+            return std::min(std::max(std::round(x), double(std::numeric_limits<int16_t>::min())),
+                            double(std::numeric_limits<int16_t>::max()));
+        case Kind::Bool: return x != 0 ? 1. : 0.;
+        default: return x;
+    }
+}
+
+// Write the narrowed representation of x into dst (only for narrowing policies)
+inline void narrow(const Policy& policy, double x, void* dst) {
+    double q = quantize(policy, x);
+    if (policy.kind == Kind::Int8) {
+        static_cast<int8_t*>(dst)[0] = int8_t(q);
+    } else if (policy.kind == Kind::Int16) {
+        static_cast<int16_t*>(dst)[0] = int16_t(q);
+    } else if (policy.kind == Kind::Bool) {
+        static_cast<bool*>(dst)[0] = q != 0;
+    }
+}
+
+// Quantization error accumulated over the job for one branch
+struct Stats {
+    uint64_t nValues = 0;
+    double maxAbsError = 0.;
+    double maxRelError = 0.;
+
+    void add(double x, double q) {
+        nValues++;
+        double err = std::abs(x - q);
+        maxAbsError = std::max(maxAbsError, err);
+        if (x != 0) { maxRelError = std::max(maxRelError, err / std::abs(x)); }
+    }
+};
+
+// A branch booked with a non-default policy
+struct BranchRecord {
+    std::string tree;
+    std::string name;
+    Policy policy;
+    char bookedType = 'F';         // 'F' (float) or 'I' (int) in memory
+    const void* values = nullptr;  // analyzer buffer
+    const int* size = nullptr;     // counter of the array, nullptr for scalars
+    std::vector<char> narrowed;    // on-disk buffer for narrowing policies
+    Stats stats;
+    long long totBytes = 0;
+    long long zipBytes = 0;
+
+    // Accumulate the quantization error and fill the narrowed buffer before TTree::Fill
+    void update() {
+        int n = size ? *size : 1;
+        size_t width = narrowSize(policy);
+        for (int i = 0; i < n; i++) {
+            double x = bookedType == 'F' ? double(static_cast<const float*>(values)[i])
+                                         : double(static_cast<const int*>(values)[i]);
+            stats.add(x, quantize(policy, x));
+            if (width) { narrow(policy, x, &narrowed[i * width]); }
+        }
+    }
+};
+
+}  // namespace precision
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef Ntuplizer_SegmentOverlap_h
+#define Ntuplizer_SegmentOverlap_h
+
+// Duplicate track resolution from shared muon segments.
+//
+// Every track is summarised by its signature, the sorted list of the keys of its DT/CSC
+// segments. The DetId of a segment is its chamber, so the key also holds the local position of
+// the segment: distinct segments in the same chamber have distinct keys, and the copies of the
+// same segment in two tracks have the same key. The pairs sharing segments are found through
+// an inverted index key -> tracks (a hash join, only tracks with a common segment are ever
+// compared). Two tracks are duplicates when the shared segments are at least minSharedFraction
+// of the segments of the shorter one. Duplicates are grouped transitively and every group is
+// represented by its best track: most segments, then lowest quality value (e.g.
+// normalizedChi2), then lowest index.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+#include <unordered_map>
+#include <vector>
+
+namespace overlap {
+
+using Signature = std::vector<uint64_t>;
+
+// Key of a segment: chamber raw DetId and local x, y in cm, in steps of 0.1 mm (16 bits each)
+inline uint64_t segmentKey(uint32_t rawId, double localX, double localY) {
+    auto pack = [](double x) { return uint64_t(uint16_t(int16_t(std::lround(x * 100.)))); };
+    return (uint64_t(rawId) << 32) | (pack(localX) << 16) | pack(localY);
+}
+
+// Sort and remove repeated segments
+inline void finalize(Signature& signature) {
+    std::sort(signature.begin(), signature.end());
+    signature.erase(std::unique(signature.begin(), signature.end()), signature.end());
+}
+
+// Representative of every track (itself when it has no duplicate), -1 for empty signatures.
+// Returns the number of duplicate pairs found
+inline unsigned int resolve(const std::vector<Signature>& signatures,
+                            const std::vector<float>& quality, double minSharedFraction,
+                            std::vector<int>& representative) {
+    const unsigned int n = signatures.size();
+    std::vector<int> parent(n);
+    std::iota(parent.begin(), parent.end(), 0);
+    auto find = [&parent](int i) {
+        while (parent[i] != i) { i = parent[i] = parent[parent[i]]; }
+        return i;
+    };
+
+    std::unordered_map<uint64_t, std::vector<unsigned int>> index;
+    for (unsigned int i = 0; i < n; i++) {
+        for (uint64_t key : signatures[i]) { index[key].push_back(i); }
+    }
+
+    // Shared segments of every track with the ones before it, through the index only
+    unsigned int nPairs = 0;
+    std::vector<unsigned int> shared(n, 0);
+    std::vector<unsigned int> touched;
+    for (unsigned int i = 0; i < n; i++) {
+        for (uint64_t key : signatures[i]) {
+            for (unsigned int j : index[key]) {
+                if (j >= i) { break; }
+                if (shared[j]++ == 0) { touched.push_back(j); }
+            }
+        }
+        for (unsigned int j : touched) {
+            size_t shorter = std::min(signatures[i].size(), signatures[j].size());
+            if (shared[j] >= minSharedFraction * shorter) {
+                nPairs++;
+                parent[find(i)] = find(j);
+            }
+            shared[j] = 0;
+        }
+        touched.clear();
+    }
+
+    // Best track of every group
+    auto better = [&](unsigned int a, unsigned int b) {
+        if (signatures[a].size() != signatures[b].size()) {
+            return signatures[a].size() > signatures[b].size();
+        }
+        if (quality[a] != quality[b]) { return quality[a] < quality[b]; }
+        return a < b;
+    };
+    std::vector<int> best(n, -1);
+    for (unsigned int i = 0; i < n; i++) {
+        int root = find(i);
+        if (best[root] < 0 || better(i, best[root])) { best[root] = i; }
+    }
+    representative.assign(n, -1);
+    for (unsigned int i = 0; i < n; i++) {
+        if (!signatures[i].empty()) { representative[i] = best[find(i)]; }
+    }
+    return nPairs;
+}
+
+}  // namespace overlap
+
+#endif
@@ -0,0 +1,172 @@
+// Synthetic events to benchmark my_ntuplizer at high multiplicity without input files.
+// Produces displaced muons (each with a standalone and a global track, in back-to-back
+// tag/probe-like pairs) and prunedGenParticles-like gen muons coming from Z_d (1023)
+// through a chain of decayDepth intermediate copies.
+
+#include <cmath>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "DataFormats/HepMCCandidate/interface/GenParticle.h"
+#include "DataFormats/HepMCCandidate/interface/GenParticleFwd.h"
+#include "DataFormats/MuonDetId/interface/DTLayerId.h"
+#include "DataFormats/MuonReco/interface/Muon.h"
+#include "DataFormats/MuonReco/interface/MuonFwd.h"
+#include "DataFormats/SiStripDetId/interface/StripSubdetector.h"
+#include "DataFormats/TrackReco/interface/Track.h"
+#include "DataFormats/TrackReco/interface/TrackFwd.h"
+#include "DataFormats/TrackingRecHit/interface/TrackingRecHit.h"
+#include "FWCore/Framework/interface/Event.h"
+#include "FWCore/Framework/interface/MakerMacros.h"
+#include "FWCore/Framework/interface/global/EDProducer.h"
+#include "FWCore/ParameterSet/interface/ConfigurationDescriptions.h"
+#include "FWCore/ParameterSet/interface/ParameterSet.h"
+#include "FWCore/ParameterSet/interface/ParameterSetDescription.h"
+
+class SyntheticMuonEventProducer : public edm::global::EDProducer<> {
+   public:
+    explicit SyntheticMuonEventProducer(const edm::ParameterSet&);
+
+    static void fillDescriptions(edm::ConfigurationDescriptions& descriptions);
+
+   private:
+    virtual void produce(edm::StreamID, edm::Event&, const edm::EventSetup&) const override;
+
+    reco::Track makeTrack(double pt, double eta, double phi, int charge, double d0, double z0,
+                          unsigned int nDTHits, unsigned int nStripHits) const;
+
+    const unsigned int nMuons_;
+    const unsigned int nGenMuons_;
+    const unsigned int decayDepth_;
+    const unsigned int seed_;
+};
+
+// Constructor
+SyntheticMuonEventProducer::SyntheticMuonEventProducer(const edm::ParameterSet& iConfig)
+    : nMuons_(iConfig.getParameter<unsigned int>("nMuons")),
+      nGenMuons_(iConfig.getParameter<unsigned int>("nGenMuons")),
+      decayDepth_(iConfig.getParameter<unsigned int>("decayDepth")),
+      seed_(iConfig.getParameter<unsigned int>("seed")) {
+    produces<reco::TrackCollection>("standAlone");
+    produces<reco::TrackCollection>("global");
+    produces<reco::MuonCollection>();
+    produces<reco::GenParticleCollection>();
+}
+
+// fillDescriptions
+void SyntheticMuonEventProducer::fillDescriptions(edm::ConfigurationDescriptions& descriptions) {
+    edm::ParameterSetDescription desc;
+    desc.add<unsigned int>("nMuons", 10);
+    desc.add<unsigned int>("nGenMuons", 10);
+    desc.add<unsigned int>("decayDepth", 1);
+    desc.add<unsigned int>("seed", 12345);
+    descriptions.add("syntheticMuonEvents", desc);
+}
+
+// Track with the given kinematics, passing the DSA (nDTHits > 30) or DGL (nStripHits > 5) tag ID
+reco::Track SyntheticMuonEventProducer::makeTrack(double pt, double eta, double phi, int charge,
+                                                  double d0, double z0, unsigned int nDTHits,
+                                                  unsigned int nStripHits) const {
+    // Reference point at distance d0 from the beam line, perpendicular to the momentum
+    reco::Track::Point point(-d0 * sin(phi), d0 * cos(phi), z0);
+    reco::Track::Vector momentum(pt * cos(phi), pt * sin(phi), pt * sinh(eta));
+    reco::TrackBase::CovarianceMatrix cov;
+    double qoverp = charge / momentum.R();
+    cov(reco::TrackBase::i_qoverp, reco::TrackBase::i_qoverp) = pow(0.05 * qoverp, 2);
+    cov(reco::TrackBase::i_lambda, reco::TrackBase::i_lambda) = 1e-6;
+    reco::Track track(30., 30., point, momentum, charge, cov);
+    for (unsigned int ihit = 0; ihit < nStripHits; ihit++) {
+        track.appendTrackerHitPattern(StripSubdetector::TOB, ihit % 6 + 1, 0,
+                                      TrackingRecHit::valid);
+    }
+    for (unsigned int ihit = 0; ihit < nDTHits; ihit++) {
+        // wheel, station, sector, superlayer, layer
+        DTLayerId layer(0, ihit / 12 % 4 + 1, 10, ihit / 4 % 3 + 1, ihit % 4 + 1);
+        track.appendMuonHitPattern(layer, TrackingRecHit::valid);
+    }
+    return track;
+}
+
+// Produce (per event)
+void SyntheticMuonEventProducer::produce(edm::StreamID, edm::Event& iEvent,
+                                         const edm::EventSetup&) const {
+    // Reproducible, independent of the stream the event runs on
+    std::mt19937 rng(seed_ + iEvent.id().event());
+    std::uniform_real_distribution<double> tagPhi(-0.7 * M_PI, -0.3 * M_PI);
+    std::uniform_real_distribution<double> etaDist(-0.6, 0.6);
+    std::uniform_real_distribution<double> ptDist(25., 100.);
+    std::uniform_real_distribution<double> d0Dist(-30., 30.);
+    std::uniform_real_distribution<double> smear(-0.05, 0.05);
+    std::bernoulli_distribution positive(0.5);
+
+    auto standAloneTracks = std::make_unique<reco::TrackCollection>();
+    auto globalTracks = std::make_unique<reco::TrackCollection>();
+    auto muons = std::make_unique<reco::MuonCollection>();
+    auto genParticles = std::make_unique<reco::GenParticleCollection>();
+    reco::TrackRefProd standAloneRefProd =
+        iEvent.getRefBeforePut<reco::TrackCollection>("standAlone");
+    reco::TrackRefProd globalRefProd = iEvent.getRefBeforePut<reco::TrackCollection>("global");
+    reco::GenParticleRefProd genRefProd = iEvent.getRefBeforePut<reco::GenParticleCollection>();
+
+    // Directions shared by the reco and gen muons, so that both can be matched
+    std::vector<double> pts, etas, phis;
+    std::vector<int> charges;
+    unsigned int nDirections = std::max(nMuons_, nGenMuons_);
+    for (unsigned int i = 0; i < nDirections; i++) {
+        // Even: downward tag leg, odd: upward leg back-to-back with the previous one
+        if (i % 2 == 0) {
+            etas.push_back(etaDist(rng));
+            phis.push_back(tagPhi(rng));
+        } else {
+            etas.push_back(-etas[i - 1]);
+            phis.push_back(phis[i - 1] + M_PI);
+        }
+        pts.push_back(ptDist(rng));
+        charges.push_back(positive(rng) ? 1 : -1);
+    }
+
+    // Reco muons
+    for (unsigned int i = 0; i < nMuons_; i++) {
+        double d0 = d0Dist(rng);
+        double z0 = d0Dist(rng);
+        standAloneTracks->push_back(makeTrack(pts[i], etas[i], phis[i], charges[i], d0, z0, 36, 0));
+        globalTracks->push_back(makeTrack(pts[i], etas[i], phis[i], charges[i], d0, z0, 20, 8));
+        reco::Particle::PolarLorentzVector p4(pts[i], etas[i], phis[i], 0.10566);
+        reco::Muon muon(charges[i], reco::Particle::LorentzVector(p4));
+        muon.setOuterTrack(reco::TrackRef(standAloneRefProd, i));
+        muon.setGlobalTrack(reco::TrackRef(globalRefProd, i));
+        muon.setType(reco::Muon::StandAloneMuon | reco::Muon::GlobalMuon);
+        muons->push_back(muon);
+    }
+
+    // Gen muons: Z_d -> (decayDepth copies) -> stable muon, two muons per Z_d
+    for (unsigned int i = 0; i < nGenMuons_; i++) {
+        reco::Particle::Point vertex(d0Dist(rng), d0Dist(rng), d0Dist(rng));
+        if (i % 2 == 0) {
+            reco::Particle::PolarLorentzVector p4(pts[i], 0., phis[i], 20.);
+            genParticles->push_back(
+                reco::GenParticle(0, reco::Particle::LorentzVector(p4), vertex, 1023, 62, true));
+        }
+        // The Z_d of this muon is the last one added
+        size_t mother = genParticles->size() - 1;
+        while (genParticles->at(mother).pdgId() != 1023) { mother--; }
+        reco::Particle::PolarLorentzVector p4(pts[i], etas[i] + smear(rng), phis[i] + smear(rng),
+                                              0.10566);
+        for (unsigned int depth = 0; depth <= decayDepth_; depth++) {
+            int status = depth == decayDepth_ ? 1 : 2;
+            reco::GenParticle genMuon(charges[i], reco::Particle::LorentzVector(p4), vertex,
+                                      -13 * charges[i], status, true);
+            genMuon.addMother(reco::GenParticleRef(genRefProd, mother));
+            genParticles->push_back(genMuon);
+            mother = genParticles->size() - 1;
+        }
+    }
+
+    iEvent.put(std::move(standAloneTracks), "standAlone");
+    iEvent.put(std::move(globalTracks), "global");
+    iEvent.put(std::move(muons));
+    iEvent.put(std::move(genParticles));
+}
+
+DEFINE_FWK_MODULE(SyntheticMuonEventProducer);
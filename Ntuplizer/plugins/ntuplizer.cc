@@ -7,7 +7,13 @@
 #include <Math/VectorUtil.h>
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <iomanip>
 #include <iostream>
+#include <map>
 #include <string>
 #include <vector>
 
@@ -25,8 +31,11 @@
 #include "FWCore/Framework/interface/ConsumesCollector.h"
 #include "FWCore/Framework/interface/ESHandle.h"
 #include "FWCore/Framework/interface/Event.h"
+#include "FWCore/Framework/interface/LuminosityBlock.h"
+#include "FWCore/Framework/interface/Run.h"
 #include "FWCore/Framework/interface/MakerMacros.h"
 #include "FWCore/ParameterSet/interface/ParameterSet.h"
+#include "FWCore/Utilities/interface/Exception.h"
 #include "SimDataFormats/GeneratorProducts/interface/HepMCProduct.h"
 #include "TrackPropagation/SteppingHelixPropagator/interface/SteppingHelixPropagator.h"
 #include "TrackingTools/Records/interface/TrackingComponentsRecord.h"
@@ -39,11 +48,18 @@
 #include "DataFormats/GeometrySurface/interface/Surface.h"
 #include "DataFormats/GeometryVector/interface/GlobalPoint.h"
 #include "DataFormats/GeometryVector/interface/GlobalVector.h"
+#include "DataFormats/GeometryVector/interface/LocalPoint.h"
+#include "DataFormats/TrackingRecHit/interface/TrackingRecHit.h"
 #include "TFile.h"
 #include "TH1F.h"
 #include "TLorentzVector.h"
 #include "TTree.h"
 
+#include "AsyncTreeWriter.h"
+#include "ColumnarWriter.h"
+#include "PrecisionPolicy.h"
+#include "SegmentOverlap.h"
+
 namespace MTYPE {
 const char* DSA = "DSA";
 const char* DGL = "DGL";
@@ -53,6 +69,9 @@ typedef ROOT::Math::XYZVector XYZVector;
 typedef std::pair<TrajectoryStateOnSurface, double> TsosPath;
 using ROOT::Math::VectorUtil::Angle;
 
+// Capacity of the genmu_* arrays, the gen muons beyond it are neither stored nor matched
+const int kMaxGenMuons = 200;
+
 
 float dxy_value(const reco::GenParticle& p, const reco::Vertex& pv) {
     float vx = p.vx();
@@ -123,7 +142,175 @@ bool hasMotherWithPdgId(const reco::Candidate* particle, int pdgId) {
     return false;
 }
 
-class my_ntuplizer : public edm::one::EDAnalyzer<edm::one::SharedResources> {
+// Detector surface to which the reco tracks are propagated: a cylinder of given radius and
+// z range or a disk at given z and radial range
+struct PropagationSurface {
+    std::string name;
+    bool isCylinder = true;
+    double radius = 0., minZ = 0., maxZ = 0.;
+    double z = 0., minR = 0., maxR = 0.;
+    Cylinder::CylinderPointer cylinder;
+    Plane::PlanePointer plane;
+};
+
+// Per-muon result of the propagation to one surface
+struct PropagationResult {
+    Float_t x[200] = {0.};
+    Float_t y[200] = {0.};
+    Float_t z[200] = {0.};
+    Float_t path[200] = {0.};
+    bool pass[200] = {false};
+};
+
+// Per-type track collection of the jagged output layout: the rows of the dmu_<type>_* arrays
+// of the muons having that track are gathered into the compact <type>_* arrays before Fill
+struct TrackCollection {
+    struct Field {
+        const char* source = nullptr;  // dmu_<type>_* array, indexed by muon
+        size_t size = 0;
+        std::vector<char> values;  // <type>_* array, indexed by track
+    };
+
+    std::string type;
+    const Int_t* selected = nullptr;  // muons having the track
+    Int_t n = 0;
+    Int_t idx[200] = {0};           // parent muon
+    std::deque<Field> fields;       // addresses bound to the branches must stay valid
+
+    // The buffers are kept when booking again after a rollover
+    Field& field(const void* source, size_t size) {
+        for (auto& booked : fields) {
+            if (booked.source == source) { return booked; }
+        }
+        fields.emplace_back();
+        fields.back().source = static_cast<const char*>(source);
+        fields.back().size = size;
+        fields.back().values.resize(200 * size);
+        return fields.back();
+    }
+
+    void gather(Int_t nMuons) {
+        n = 0;
+        for (Int_t i = 0; i < nMuons; i++) {
+            if (selected[i]) { idx[n++] = i; }
+        }
+        for (auto& field : fields) {
+            for (Int_t k = 0; k < n; k++) {
+                std::memcpy(&field.values[k * field.size], field.source + idx[k] * field.size,
+                            field.size);
+            }
+        }
+    }
+};
+
+bool passStraightLineAcceptance(const PropagationSurface& surface, const GlobalPoint& point,
+                                const GlobalVector& direction, double margin) {
+    // Cheap pre-selection: a straight line from the reference point along the momentum
+    // must reach the surface within the margin, otherwise the full propagation is skipped
+    GlobalVector u = direction.unit();
+    if (surface.isCylinder) {
+        double uT2 = u.x() * u.x() + u.y() * u.y();
+        if (uT2 <= 0) { return false; }
+        // Transverse distance of closest approach to the z axis
+        double d0 = std::abs(point.x() * u.y() - point.y() * u.x()) / std::sqrt(uT2);
+        if (d0 > surface.radius + margin) { return false; }
+        // First crossing of r = radius (or closest approach) along the momentum
+        double b = (point.x() * u.x() + point.y() * u.y()) / uT2;
+        double c = (point.perp2() - surface.radius * surface.radius) / uT2;
+        double s = -b;
+        if (b * b - c >= 0) {
+            double sq = std::sqrt(b * b - c);
+            s = (-b - sq >= 0) ? -b - sq : -b + sq;
+        }
+        if (s < 0) { return false; }
+        double zAtSurface = point.z() + s * u.z();
+        return zAtSurface >= surface.minZ - margin && zAtSurface <= surface.maxZ + margin;
+    }
+    if (u.z() == 0) { return false; }
+    double s = (surface.z - point.z()) / u.z();
+    if (s < 0) { return false; }
+    double rAtSurface = std::hypot(point.x() + s * u.x(), point.y() + s * u.y());
+    return rAtSurface >= surface.minR - margin && rAtSurface <= surface.maxR + margin;
+}
+
+// Per run / lumi bookkeeping stored in the Runs and Lumis trees
+struct SummaryCounts {
+    Long64_t eventsSeen = 0;
+    Long64_t eventsWritten = 0;
+    Long64_t dsaTags = 0;
+    Long64_t dsaProbes = 0;
+    Long64_t dglTags = 0;
+    Long64_t dglProbes = 0;
+    Long64_t triggerFires[200] = {0};
+
+    void add(const SummaryCounts& other) {
+        eventsSeen += other.eventsSeen;
+        eventsWritten += other.eventsWritten;
+        dsaTags += other.dsaTags;
+        dsaProbes += other.dsaProbes;
+        dglTags += other.dglTags;
+        dglProbes += other.dglProbes;
+        for (int i = 0; i < 200; i++) { triggerFires[i] += other.triggerFires[i]; }
+    }
+};
+
+// Lumi or run row finished while no output file was open, written to the next file
+struct SummaryRow {
+    Int_t run = 0;
+    Int_t lumi = 0;
+    SummaryCounts counts;
+};
+
+// Counters incremented from analyze() without locks, read and reset at the lumi boundaries
+struct SummaryCounters {
+    std::atomic<Long64_t> eventsSeen{0};
+    std::atomic<Long64_t> eventsWritten{0};
+    std::atomic<Long64_t> dsaTags{0};
+    std::atomic<Long64_t> dsaProbes{0};
+    std::atomic<Long64_t> dglTags{0};
+    std::atomic<Long64_t> dglProbes{0};
+    std::atomic<Long64_t> triggerFires[200];
+
+    SummaryCounters() {
+        for (auto& fires : triggerFires) { fires.store(0, std::memory_order_relaxed); }
+    }
+
+    static void increment(std::atomic<Long64_t>& counter, Long64_t n = 1) {
+        counter.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    // Counts accumulated since the previous call
+    SummaryCounts take() {
+        SummaryCounts counts;
+        counts.eventsSeen = eventsSeen.exchange(0);
+        counts.eventsWritten = eventsWritten.exchange(0);
+        counts.dsaTags = dsaTags.exchange(0);
+        counts.dsaProbes = dsaProbes.exchange(0);
+        counts.dglTags = dglTags.exchange(0);
+        counts.dglProbes = dglProbes.exchange(0);
+        for (int i = 0; i < 200; i++) { counts.triggerFires[i] = triggerFires[i].exchange(0); }
+        return counts;
+    }
+};
+
+// Stages of analyze() timed when timeStages is set
+enum Stage {
+    kSetup,
+    kGenMatching,
+    kCosmicsGen,
+    kMuons,
+    kOverlap,
+    kPropagation,
+    kTagAndProbe,
+    kTrigger,
+    kFill,
+    kNStages
+};
+const char* stageNames[kNStages] = {"setup",   "genMatching", "cosmicsGen",  "muons", "overlap",
+                                    "propagation", "tagAndProbe", "trigger", "fill"};
+
+class my_ntuplizer : public edm::one::EDAnalyzer<edm::one::SharedResources, edm::one::WatchRuns,
+                                                 edm::one::WatchLuminosityBlocks> {
    public:
     explicit my_ntuplizer(const edm::ParameterSet&);
     ~my_ntuplizer();
@@ -135,11 +322,38 @@ class my_ntuplizer : public edm::one::EDAnalyzer<edm::one::SharedResources> {
     virtual void beginJob() override;
     virtual void analyze(const edm::Event&, const edm::EventSetup&) override;
     virtual void endJob() override;
+    virtual void beginRun(const edm::Run&, const edm::EventSetup&) override {}
+    virtual void endRun(const edm::Run&, const edm::EventSetup&) override;
+    virtual void beginLuminosityBlock(const edm::LuminosityBlock&,
+                                      const edm::EventSetup&) override {}
+    virtual void endLuminosityBlock(const edm::LuminosityBlock&, const edm::EventSetup&) override;
+
+    void openOutputFile();
+    void closeOutputFile();
+    void bookBranches();
+    void fillTree(TTree* tree);
+    void bookSummaryTree(TTree* tree);
+    void flushLumi(Int_t runNumber, Int_t lumiNumber);
+    void flushRun(Int_t runNumber);
+    void bookArray(TTree* tree, const char* name, void* values, char type, const char* sizeName,
+                   Int_t* size, const char* alias = nullptr);
+    void bookTrackArray(const char* name, void* values, char type);
+    void updatePrecision(const TTree* tree);
+    void harvestPrecision(const TTree* tree);
+    void printPrecisionReport() const;
+    void startStages();
+    void stopStage(Stage stage);
+    void printStageReport() const;
+    void propagateToSurfaces(const std::vector<std::pair<unsigned int, const reco::Track*>>& batch,
+                             std::vector<PropagationResult>& results,
+                             const Propagator* propagator, const MagneticField* magField);
 
     edm::ParameterSet parameters;
 
     bool isCosmics = true;
     bool isAOD = false;
+    // Propagate the cosmics MC gen muons to the tracker for passTrackerPointing
+    bool computeTrackerPointing = false;
     //
     // --- Tokens and Handles
     //
@@ -167,6 +381,25 @@ class my_ntuplizer : public edm::one::EDAnalyzer<edm::one::SharedResources> {
     Int_t run = 0;
     bool passTrackerPointing = false;
 
+    // Propagation of the reco DSA/DGL tracks to detector surfaces
+    std::vector<PropagationSurface> propagationSurfaces;
+    double propagationMargin = 20.;
+    std::vector<PropagationResult> dmu_dsa_propagation;
+    std::vector<PropagationResult> dmu_dgl_propagation;
+
+    // Output layout: dmu_<type>_* arrays aligned to ndmu or jagged <type>_* collections
+    bool jaggedLayout = false;
+    std::deque<TrackCollection> trackCollections;
+
+    // Duplicate DSA tracks sharing muon segments (AOD only)
+    bool findDuplicateDSA = false;
+    double duplicateSharedFraction = 0.5;
+    bool excludeDuplicateDSA = false;
+    std::vector<overlap::Signature> dsaSignatures;
+    std::vector<float> dsaQuality;
+    std::vector<int> dsaRepresentative;
+    Long64_t nDuplicateDSA = 0;
+
     // ----------------------------------
     // displacedMuons
     // ----------------------------------
@@ -174,6 +407,7 @@ class my_ntuplizer : public edm::one::EDAnalyzer<edm::one::SharedResources> {
     Int_t dmu_isDSA[200] = {0};
     Int_t dmu_isDGL[200] = {0};
     Int_t dmu_isDTK[200] = {0};
+    Int_t dmu_hasDTK[200] = {0};  // inner track available (jagged layout only)
     Int_t dmu_isMatchesValid[200] = {0};
     Int_t dmu_numberOfMatches[200] = {0};
     Int_t dmu_numberOfChambers[200] = {0};
@@ -205,6 +439,9 @@ class my_ntuplizer : public edm::one::EDAnalyzer<edm::one::SharedResources> {
     bool dmu_dsa_hasProbe[200] = {false};
     Int_t dmu_dsa_probeID[200] = {0};
     Float_t dmu_dsa_cosAlpha[200] = {0.};
+    // Variables for duplicate removal
+    bool dmu_dsa_isDuplicate[200] = {false};
+    Int_t dmu_dsa_representative[200] = {0};
 
     Float_t dmu_dgl_pt[200] = {0.};
     Float_t dmu_dgl_eta[200] = {0.};
@@ -260,21 +497,71 @@ class my_ntuplizer : public edm::one::EDAnalyzer<edm::one::SharedResources> {
     Int_t dmu_dsa_genMatchedID[200] = {0};
     Int_t dmu_dgl_genMatchedID[200] = {0};
     Int_t ngenmu = 0;
-    bool genmu_genMatched[20] = {false};
-    Float_t genmu_lxy[20] = {0.};
-    Float_t genmu_lz[20] = {0.};
-    Float_t genmu_pt[20] = {0.};
-    Float_t genmu_eta[20] = {0.};
-    Float_t genmu_phi[20] = {0.};
+    bool genmu_genMatched[kMaxGenMuons] = {false};
+    Float_t genmu_lxy[kMaxGenMuons] = {0.};
+    Float_t genmu_lz[kMaxGenMuons] = {0.};
+    Float_t genmu_pt[kMaxGenMuons] = {0.};
+    Float_t genmu_eta[kMaxGenMuons] = {0.};
+    Float_t genmu_phi[kMaxGenMuons] = {0.};
 
     //
     // --- Output
     //
     std::string output_filename;
     TH1F* counts;
-    TFile* file_out;
-    TTree* tree_out;
-    TTree* gen_tree_out;
+    TFile* file_out = nullptr;
+    TTree* tree_out = nullptr;
+    TTree* gen_tree_out = nullptr;
+    TTree* lumis_out = nullptr;
+    TTree* runs_out = nullptr;
+
+    // Per lumi / run bookkeeping: the counters of the current lumi are added to the run totals
+    // and written to the Lumis tree at the end of the lumi (or when the file is closed, in which
+    // case a lumi has one entry per file and the entries add up)
+    SummaryCounters lumiCounters;
+    SummaryCounts runCounts;
+    // Lumi and run with events not flushed yet by endLuminosityBlock / endRun
+    bool lumiOpen = false;
+    bool runOpen = false;
+    // Rows of the lumis and runs ending between a rollover and the next event
+    std::vector<SummaryRow> pendingLumis;
+    std::vector<SummaryRow> pendingRuns;
+    SummaryCounts summaryBuffer;
+    Int_t summaryRun = 0;
+    Int_t summaryLumi = 0;
+
+    // Flat columnar export of the Events and GenParticles trees (optional)
+    std::string columnarOutput;
+    double columnarChunkMB = 16.;
+    std::unique_ptr<columnar::ColumnarWriter> columnarEvents;
+    std::unique_ptr<columnar::ColumnarWriter> columnarGen;
+
+    // Background writer thread doing the Events and GenParticles fills (optional)
+    bool asyncWrite = false;
+    unsigned int asyncQueueDepth = 2;
+    std::unique_ptr<async::AsyncTreeWriter> asyncWriter;
+
+    // Per-stage timing of analyze()
+    bool timeStages = false;
+    Long64_t nTimedEvents = 0;
+    double stageTime[kNStages] = {0.};
+    std::chrono::steady_clock::time_point stageStart;
+
+    // Output rollover: a new numbered file is started when any limit is reached (0 = no limit)
+    double maxFileSizeMB = 0.;
+    Long64_t maxEventsPerFile = 0;
+    Int_t maxLumisPerFile = 0;
+    bool rollover = false;
+    Int_t fileIndex = 0;
+    // Bookkeeping of the file being written, stored in its Metadata tree
+    Long64_t fileEvents = 0;
+    Int_t fileLumis = 0;
+    Int_t firstRun = 0, firstLumi = 0, firstEvent = 0;
+    Int_t lastRun = 0, lastLumi = 0, lastEvent = 0;
+
+    // Storage precision policies (branch name -> policy) and the branches booked with them
+    std::map<std::string, precision::Policy> precisionPolicies;
+    std::vector<precision::BranchRecord> precisionBranches;
 };
 
 // Constructor
@@ -287,15 +574,155 @@ my_ntuplizer::my_ntuplizer(const edm::ParameterSet& iConfig) {
     isCosmics = parameters.getParameter<bool>("isCosmics");
     isAOD = parameters.getParameter<bool>("isAOD");
 
+    // Per-branch storage precision (optional)
+    if (parameters.exists("precisionPolicies")) {
+        for (const auto& pset :
+             parameters.getParameter<std::vector<edm::ParameterSet>>("precisionPolicies")) {
+            precision::Policy policy;
+            std::string kind = pset.getParameter<std::string>("policy");
+            if (!precision::parseKind(kind, policy.kind)) {
+                throw cms::Exception("Configuration")
+                    << "Unknown precision policy '" << kind << "'";
+            }
+            if (pset.existsAs<double>("min")) { policy.min = pset.getParameter<double>("min"); }
+            if (pset.existsAs<double>("max")) { policy.max = pset.getParameter<double>("max"); }
+            if (pset.existsAs<int>("nbits")) { policy.nbits = pset.getParameter<int>("nbits"); }
+            std::string error = precision::validate(policy);
+            if (!error.empty()) { throw cms::Exception("Configuration") << error; }
+            for (const auto& branch : pset.getParameter<std::vector<std::string>>("branches")) {
+                precisionPolicies[branch] = policy;
+            }
+        }
+    }
+
+    // Propagation surfaces (optional), built once for the whole job
+    if (parameters.exists("propagationSurfaces")) {
+        const Surface::RotationType dummyRot;
+        for (const auto& pset :
+             parameters.getParameter<std::vector<edm::ParameterSet>>("propagationSurfaces")) {
+            PropagationSurface surface;
+            surface.name = pset.getParameter<std::string>("name");
+            std::string type = pset.getParameter<std::string>("type");
+            if (type == "cylinder") {
+                surface.radius = pset.getParameter<double>("radius");
+                surface.minZ = pset.getParameter<double>("minZ");
+                surface.maxZ = pset.getParameter<double>("maxZ");
+                surface.cylinder =
+                    Cylinder::build(Surface::PositionType(0., 0., 0.), dummyRot, surface.radius);
+            } else if (type == "disk") {
+                surface.isCylinder = false;
+                surface.z = pset.getParameter<double>("z");
+                surface.minR = pset.getParameter<double>("minR");
+                surface.maxR = pset.getParameter<double>("maxR");
+                surface.plane = Plane::build(Surface::PositionType(0., 0., surface.z), dummyRot);
+            } else {
+                throw cms::Exception("Configuration")
+                    << "Unknown propagation surface type '" << type << "'";
+            }
+            propagationSurfaces.push_back(surface);
+        }
+        if (parameters.exists("propagationMargin")) {
+            propagationMargin = parameters.getParameter<double>("propagationMargin");
+        }
+        dmu_dsa_propagation.resize(propagationSurfaces.size());
+        dmu_dgl_propagation.resize(propagationSurfaces.size());
+    }
+
+    // Output layout (optional)
+    if (parameters.exists("outputLayout")) {
+        std::string layout = parameters.getParameter<std::string>("outputLayout");
+        if (layout != "aligned" && layout != "jagged") {
+            throw cms::Exception("Configuration") << "Unknown outputLayout '" << layout << "'";
+        }
+        jaggedLayout = layout == "jagged";
+    }
+    if (jaggedLayout) {
+        for (auto type : {"dsa", "dgl", "dtk"}) {
+            trackCollections.emplace_back();
+            trackCollections.back().type = type;
+        }
+        trackCollections[0].selected = dmu_isDSA;
+        trackCollections[1].selected = dmu_isDGL;
+        trackCollections[2].selected = dmu_hasDTK;
+    }
+
+    // Duplicate DSA removal (optional)
+    if (parameters.exists("findDuplicateDSA")) {
+        findDuplicateDSA = parameters.getParameter<bool>("findDuplicateDSA");
+    }
+    if (parameters.exists("duplicateSharedFraction")) {
+        duplicateSharedFraction = parameters.getParameter<double>("duplicateSharedFraction");
+    }
+    if (parameters.exists("excludeDuplicateDSA")) {
+        excludeDuplicateDSA = parameters.getParameter<bool>("excludeDuplicateDSA");
+    }
+    if (findDuplicateDSA && !isAOD) {
+        std::cout << "findDuplicateDSA needs the DSA rechits, which are only in AOD: "
+                  << "no DSA will be flagged as duplicate" << std::endl;
+    }
+
+    // Columnar export (optional)
+    if (parameters.exists("columnarOutput")) {
+        columnarOutput = parameters.getParameter<std::string>("columnarOutput");
+    }
+    if (parameters.exists("columnarChunkMB")) {
+        columnarChunkMB = parameters.getParameter<double>("columnarChunkMB");
+    }
+
+    // Writer thread (optional)
+    if (parameters.exists("asyncWrite")) {
+        asyncWrite = parameters.getParameter<bool>("asyncWrite");
+    }
+    if (parameters.exists("asyncQueueDepth")) {
+        int depth = parameters.getParameter<int>("asyncQueueDepth");
+        if (depth < 1) {
+            throw cms::Exception("Configuration")
+                << "asyncQueueDepth must be at least 1, got " << depth;
+        }
+        asyncQueueDepth = depth;
+    }
+
+    if (parameters.exists("timeStages")) {
+        timeStages = parameters.getParameter<bool>("timeStages");
+    }
+
+    // Output rollover (optional)
+    if (parameters.exists("maxFileSizeMB")) {
+        maxFileSizeMB = parameters.getParameter<double>("maxFileSizeMB");
+    }
+    if (parameters.exists("maxEventsPerFile")) {
+        maxEventsPerFile = parameters.getParameter<int>("maxEventsPerFile");
+    }
+    if (parameters.exists("maxLumisPerFile")) {
+        maxLumisPerFile = parameters.getParameter<int>("maxLumisPerFile");
+    }
+    rollover = maxFileSizeMB > 0 || maxEventsPerFile > 0 || maxLumisPerFile > 0;
+
     counts = new TH1F("counts", "", 1, 0, 1);
+    counts->SetDirectory(nullptr);
 
     dmuToken = consumes<edm::View<reco::Muon>>(
         parameters.getParameter<edm::InputTag>("displacedMuonCollection"));
-    prunedGenToken = consumes<edm::View<reco::GenParticle>>(
-        parameters.getParameter<edm::InputTag>("prunedGenParticles"));
-    thePropAlongToken = esConsumes(
-        edm::ESInputTag("", parameters.getParameter<std::string>("propagatorAlong")));
-    
+    // The gen particles and the propagator are only needed by some profiles (LLP and cosmics MC)
+    if (parameters.exists("prunedGenParticles")) {
+        prunedGenToken = consumes<edm::View<reco::GenParticle>>(
+            parameters.getParameter<edm::InputTag>("prunedGenParticles"));
+    } else if (!isCosmics) {
+        throw cms::Exception("Configuration") << "The LLP gen matching needs prunedGenParticles";
+    }
+    // The framework prefetches every consumed EventSetup product, so the propagator (and the
+    // magnetic field behind it) is only consumed by the jobs that propagate
+    if (parameters.exists("computeTrackerPointing")) {
+        computeTrackerPointing = parameters.getParameter<bool>("computeTrackerPointing");
+    }
+    if (computeTrackerPointing || !propagationSurfaces.empty()) {
+        if (!parameters.exists("propagatorAlong")) {
+            throw cms::Exception("Configuration")
+                << "computeTrackerPointing and propagationSurfaces need propagatorAlong";
+        }
+        thePropAlongToken = esConsumes(
+            edm::ESInputTag("", parameters.getParameter<std::string>("propagatorAlong")));
+    }
 
     triggerBits_ = consumes<edm::TriggerResults>(parameters.getParameter<edm::InputTag>("bits"));
 }
@@ -307,16 +734,194 @@ my_ntuplizer::~my_ntuplizer() {}
 void my_ntuplizer::beginJob() {
     std::cout << "Begin Job" << std::endl;
 
-    // Init the file and the TTree
     output_filename = parameters.getParameter<std::string>("nameOfOutput");
-    file_out = new TFile(output_filename.c_str(), "RECREATE");
-    tree_out = new TTree("Events", "Events");
-    gen_tree_out = new TTree("GenParticles", "GenParticles");
 
     // Load HLT paths
     HLTPaths_.push_back("HLT_L2Mu10_NoVertex_NoBPTX3BX");
     HLTPaths_.push_back("HLT_L2Mu10_NoVertex_NoBPTX");
 
+    if (asyncWrite) {
+        asyncWriter = std::make_unique<async::AsyncTreeWriter>(asyncQueueDepth, 200);
+    }
+
+    openOutputFile();
+}
+
+// Open the next output file and book the trees in it.
+// Without rollover the file is nameOfOutput, otherwise <stem>_<index>.root
+void my_ntuplizer::openOutputFile() {
+    std::string filename = output_filename;
+    if (rollover) {
+        std::string stem = filename;
+        std::string ext = "";
+        size_t dot = filename.rfind(".root");
+        if (dot != std::string::npos) {
+            stem = filename.substr(0, dot);
+            ext = filename.substr(dot);
+        }
+        filename = TString::Format("%s_%04d%s", stem.c_str(), fileIndex, ext.c_str()).Data();
+    }
+    std::cout << "Opening output file " << filename << std::endl;
+
+    file_out = new TFile(filename.c_str(), "RECREATE");
+    tree_out = new TTree("Events", "Events");
+    gen_tree_out = new TTree("GenParticles", "GenParticles");
+    lumis_out = new TTree("Lumis", "Lumis");
+    runs_out = new TTree("Runs", "Runs");
+    bookBranches();
+    lumis_out->Branch("run", &summaryRun, "run/I");
+    lumis_out->Branch("luminosityBlock", &summaryLumi, "luminosityBlock/I");
+    bookSummaryTree(lumis_out);
+    runs_out->Branch("run", &summaryRun, "run/I");
+    bookSummaryTree(runs_out);
+    for (const auto& row : pendingLumis) {
+        summaryRun = row.run;
+        summaryLumi = row.lumi;
+        summaryBuffer = row.counts;
+        lumis_out->Fill();
+    }
+    for (const auto& row : pendingRuns) {
+        summaryRun = row.run;
+        summaryBuffer = row.counts;
+        runs_out->Fill();
+    }
+    pendingLumis.clear();
+    pendingRuns.clear();
+
+    // The columns are bound once to the analyzer buffers, the trees of later files use the same
+    if (!columnarOutput.empty() && !columnarEvents) {
+        columnarEvents =
+            std::make_unique<columnar::ColumnarWriter>(columnarOutput + "/Events", columnarChunkMB);
+        columnarEvents->bind(tree_out);
+        columnarGen = std::make_unique<columnar::ColumnarWriter>(columnarOutput + "/GenParticles",
+                                                                 columnarChunkMB);
+        columnarGen->bind(gen_tree_out);
+    }
+    // From here on the branches of the event trees point to the writer thread buffers
+    if (asyncWriter) {
+        asyncWriter->attach(tree_out);
+        asyncWriter->attach(gen_tree_out);
+    }
+
+    fileEvents = 0;
+    fileLumis = 0;
+}
+
+// Write everything belonging to the current file and close it, so that it is usable on its own
+void my_ntuplizer::closeOutputFile() {
+    if (asyncWriter) { asyncWriter->detachAll(); }
+
+    // Counts of the lumi and run still open go to this file, the rest to the next one
+    if (lumiOpen) { flushLumi(lastRun, lastLumi); }
+    if (runOpen) { flushRun(lastRun); }
+
+    file_out->cd();
+    tree_out->Write();
+    gen_tree_out->Write();
+    lumis_out->Write();
+    runs_out->Write();
+    counts->Write();
+    harvestPrecision(tree_out);
+    harvestPrecision(gen_tree_out);
+
+    // A file holding only pending lumi / run rows has no event range
+    if (fileEvents == 0) { firstRun = firstLumi = firstEvent = lastRun = lastLumi = lastEvent = 0; }
+
+    TTree* metadata = new TTree("Metadata", "Metadata");
+    Bool_t metaIsCosmics = isCosmics;
+    Bool_t metaIsAOD = isAOD;
+    metadata->Branch("fileIndex", &fileIndex, "fileIndex/I");
+    metadata->Branch("nEvents", &fileEvents, "nEvents/L");
+    metadata->Branch("nLumis", &fileLumis, "nLumis/I");
+    metadata->Branch("firstRun", &firstRun, "firstRun/I");
+    metadata->Branch("firstLumi", &firstLumi, "firstLumi/I");
+    metadata->Branch("firstEvent", &firstEvent, "firstEvent/I");
+    metadata->Branch("lastRun", &lastRun, "lastRun/I");
+    metadata->Branch("lastLumi", &lastLumi, "lastLumi/I");
+    metadata->Branch("lastEvent", &lastEvent, "lastEvent/I");
+    metadata->Branch("isCosmics", &metaIsCosmics, "isCosmics/O");
+    metadata->Branch("isAOD", &metaIsAOD, "isAOD/O");
+    metadata->Fill();
+    metadata->Write();
+
+    file_out->Close();
+    delete file_out;
+    file_out = nullptr;
+    tree_out = nullptr;
+    gen_tree_out = nullptr;
+    lumis_out = nullptr;
+    runs_out = nullptr;
+    counts->Reset();
+    fileIndex++;
+}
+
+// Fill a tree of the event loop, directly or through the writer thread
+void my_ntuplizer::fillTree(TTree* tree) {
+    if (asyncWriter) {
+        asyncWriter->push(tree);
+    } else {
+        tree->Fill();
+    }
+}
+
+// Counters shared by the Lumis and Runs trees
+void my_ntuplizer::bookSummaryTree(TTree* tree) {
+    tree->Branch("nEvents", &summaryBuffer.eventsSeen, "nEvents/L");
+    tree->Branch("nEventsWritten", &summaryBuffer.eventsWritten, "nEventsWritten/L");
+    tree->Branch("nTagsDSA", &summaryBuffer.dsaTags, "nTagsDSA/L");
+    tree->Branch("nProbesDSA", &summaryBuffer.dsaProbes, "nProbesDSA/L");
+    tree->Branch("nTagsDGL", &summaryBuffer.dglTags, "nTagsDGL/L");
+    tree->Branch("nProbesDGL", &summaryBuffer.dglProbes, "nProbesDGL/L");
+    for (unsigned int ihlt = 0; ihlt < HLTPaths_.size(); ihlt++) {
+        TString name = "nFired_" + HLTPaths_[ihlt];
+        tree->Branch(name, &summaryBuffer.triggerFires[ihlt], name + "/L");
+    }
+}
+
+// Write the counts of the current lumi and add them to the run totals
+void my_ntuplizer::flushLumi(Int_t runNumber, Int_t lumiNumber) {
+    summaryBuffer = lumiCounters.take();
+    runCounts.add(summaryBuffer);
+    if (!file_out) {
+        pendingLumis.push_back({runNumber, lumiNumber, summaryBuffer});
+        return;
+    }
+    if (asyncWriter) { asyncWriter->drain(); }
+    summaryRun = runNumber;
+    summaryLumi = lumiNumber;
+    lumis_out->Fill();
+}
+
+// Write the run totals accumulated since the last flush
+void my_ntuplizer::flushRun(Int_t runNumber) {
+    summaryBuffer = runCounts;
+    runCounts = SummaryCounts();
+    if (!file_out) {
+        pendingRuns.push_back({runNumber, 0, summaryBuffer});
+        return;
+    }
+    if (asyncWriter) { asyncWriter->drain(); }
+    summaryRun = runNumber;
+    runs_out->Fill();
+}
+
+// endLuminosityBlock (after the last event of the lumi)
+void my_ntuplizer::endLuminosityBlock(const edm::LuminosityBlock& iLumi, const edm::EventSetup&) {
+    // If the file was closed by a rollover the row is kept for the next file
+    flushLumi(iLumi.run(), iLumi.luminosityBlock());
+    lumiOpen = false;
+    // A file full of lumis is finalized now, not when the first event of the next lumi arrives
+    if (file_out && maxLumisPerFile > 0 && fileLumis >= maxLumisPerFile) { closeOutputFile(); }
+}
+
+// endRun (after the last lumi of the run)
+void my_ntuplizer::endRun(const edm::Run& iRun, const edm::EventSetup&) {
+    flushRun(iRun.run());
+    runOpen = false;
+}
+
+// Book all the branches of the output trees
+void my_ntuplizer::bookBranches() {
     // TTree branches
     tree_out->Branch("event", &event, "event/I");
     tree_out->Branch("lumiBlock", &lumiBlock, "lumiBlock/I");
@@ -327,76 +932,86 @@ void my_ntuplizer::beginJob() {
     // displacedMuons
     // ----------------------------------
     tree_out->Branch("ndmu", &ndmu, "ndmu/I");
-    tree_out->Branch("dmu_isDSA", dmu_isDSA, "dmu_isDSA[ndmu]/I");
-    tree_out->Branch("dmu_isDGL", dmu_isDGL, "dmu_isDGL[ndmu]/I");
-    tree_out->Branch("dmu_isDTK", dmu_isDTK, "dmu_isDTK[ndmu]/I");
-    tree_out->Branch("dmu_isMatchesValid", dmu_isMatchesValid, "dmu_isMatchesValid[ndmu]/I");
-    tree_out->Branch("dmu_numberOfMatches", dmu_numberOfMatches, "dmu_numberOfMatches[ndmu]/I");
-    tree_out->Branch("dmu_numberOfChambers", dmu_numberOfChambers, "dmu_numberOfChambers[ndmu]/I");
-    tree_out->Branch("dmu_numberOfChambersCSCorDT", dmu_numberOfChambersCSCorDT,
-                     "dmu_numberOfChambersCSCorDT[ndmu]/I");
-    tree_out->Branch("dmu_numberOfMatchedStations", dmu_numberOfMatchedStations,
-                     "dmu_numberOfMatchedStations[ndmu]/I");
-    tree_out->Branch("dmu_numberOfMatchedRPCLayers", dmu_numberOfMatchedRPCLayers,
-                     "dmu_numberOfMatchedRPCLayers[ndmu]/I");
+    bookArray(tree_out, "dmu_isDSA", dmu_isDSA, 'I', "ndmu", &ndmu);
+    bookArray(tree_out, "dmu_isDGL", dmu_isDGL, 'I', "ndmu", &ndmu);
+    bookArray(tree_out, "dmu_isDTK", dmu_isDTK, 'I', "ndmu", &ndmu);
+    bookArray(tree_out, "dmu_isMatchesValid", dmu_isMatchesValid, 'I', "ndmu", &ndmu);
+    bookArray(tree_out, "dmu_numberOfMatches", dmu_numberOfMatches, 'I', "ndmu", &ndmu);
+    bookArray(tree_out, "dmu_numberOfChambers", dmu_numberOfChambers, 'I', "ndmu", &ndmu);
+    bookArray(tree_out, "dmu_numberOfChambersCSCorDT", dmu_numberOfChambersCSCorDT,
+              'I', "ndmu", &ndmu);
+    bookArray(tree_out, "dmu_numberOfMatchedStations", dmu_numberOfMatchedStations,
+              'I', "ndmu", &ndmu);
+    bookArray(tree_out, "dmu_numberOfMatchedRPCLayers", dmu_numberOfMatchedRPCLayers,
+              'I', "ndmu", &ndmu);
+    // Counters and parent muon of the jagged collections
+    for (auto& collection : trackCollections) {
+        TString counter = "n" + collection.type;
+        tree_out->Branch(counter, &collection.n, counter + "/I");
+        bookArray(tree_out, (collection.type + "_idx").c_str(), collection.idx, 'I', counter,
+                  &collection.n);
+    }
     // dmu_dsa
-    tree_out->Branch("dmu_dsa_pt", dmu_dsa_pt, "dmu_dsa_pt[ndmu]/F");
-    tree_out->Branch("dmu_dsa_eta", dmu_dsa_eta, "dmu_dsa_eta[ndmu]/F");
-    tree_out->Branch("dmu_dsa_phi", dmu_dsa_phi, "dmu_dsa_phi[ndmu]/F");
-    tree_out->Branch("dmu_dsa_ptError", dmu_dsa_ptError, "dmu_dsa_ptError[ndmu]/F");
-    tree_out->Branch("dmu_dsa_dxy", dmu_dsa_dxy, "dmu_dsa_dxy[ndmu]/F");
-    tree_out->Branch("dmu_dsa_pca_phi", dmu_dsa_pca_phi, "dmu_dsa_pca_phi[ndmu]/F");
-    tree_out->Branch("dmu_dsa_dz", dmu_dsa_dz, "dmu_dsa_dz[ndmu]/F");
-    tree_out->Branch("dmu_dsa_normalizedChi2", dmu_dsa_normalizedChi2,
-                     "dmu_dsa_normalizedChi2[ndmu]/F");
-    tree_out->Branch("dmu_dsa_charge", dmu_dsa_charge, "dmu_dsa_charge[ndmu]/F");
-    tree_out->Branch("dmu_dsa_nMuonHits", dmu_dsa_nMuonHits, "dmu_dsa_nMuonHits[ndmu]/I");
-    tree_out->Branch("dmu_dsa_nValidMuonHits", dmu_dsa_nValidMuonHits,
-                     "dmu_dsa_nValidMuonHits[ndmu]/I");
-    tree_out->Branch("dmu_dsa_nValidMuonDTHits", dmu_dsa_nValidMuonDTHits,
-                     "dmu_dsa_nValidMuonDTHits[ndmu]/I");
-    tree_out->Branch("dmu_dsa_nValidMuonCSCHits", dmu_dsa_nValidMuonCSCHits,
-                     "dmu_dsa_nValidMuonCSCHits[ndmu]/I");
-    tree_out->Branch("dmu_dsa_nValidMuonRPCHits", dmu_dsa_nValidMuonRPCHits,
-                     "dmu_dsa_nValidMuonRPCHits[ndmu]/I");
-    tree_out->Branch("dmu_dsa_nValidStripHits", dmu_dsa_nValidStripHits,
-                     "dmu_dsa_nValidStripHits[ndmu]/I");
-    tree_out->Branch("dmu_dsa_nhits", dmu_dsa_nhits, "dmu_dsa_nhits[ndmu]/I");
-    tree_out->Branch("dmu_dsa_dtStationsWithValidHits", dmu_dsa_dtStationsWithValidHits,
-                     "dmu_dsa_dtStationsWithValidHits[ndmu]/I");
-    tree_out->Branch("dmu_dsa_cscStationsWithValidHits", dmu_dsa_cscStationsWithValidHits,
-                     "dmu_dsa_cscStationsWithValidHits[ndmu]/I");
-    tree_out->Branch("dmu_dsa_nsegments", dmu_dsa_nsegments, "dmu_dsa_nsegments[ndmu]/I");
-    tree_out->Branch("dmu_dsa_passTagID", dmu_dsa_passTagID, "dmu_dsa_passTagID[ndmu]/O");
-    tree_out->Branch("dmu_dsa_hasProbe", dmu_dsa_hasProbe, "dmu_dsa_hasProbe[ndmu]/O");
-    tree_out->Branch("dmu_dsa_probeID", dmu_dsa_probeID, "dmu_dsa_probeID[ndmu]/I");
-    tree_out->Branch("dmu_dsa_cosAlpha", dmu_dsa_cosAlpha, "dmu_dsa_cosAlpha[ndmu]/F");
+    bookTrackArray("dmu_dsa_pt", dmu_dsa_pt, 'F');
+    bookTrackArray("dmu_dsa_eta", dmu_dsa_eta, 'F');
+    bookTrackArray("dmu_dsa_phi", dmu_dsa_phi, 'F');
+    bookTrackArray("dmu_dsa_ptError", dmu_dsa_ptError, 'F');
+    bookTrackArray("dmu_dsa_dxy", dmu_dsa_dxy, 'F');
+    bookTrackArray("dmu_dsa_pca_phi", dmu_dsa_pca_phi, 'F');
+    bookTrackArray("dmu_dsa_dz", dmu_dsa_dz, 'F');
+    bookTrackArray("dmu_dsa_normalizedChi2", dmu_dsa_normalizedChi2, 'F');
+    bookTrackArray("dmu_dsa_charge", dmu_dsa_charge, 'F');
+    bookTrackArray("dmu_dsa_nMuonHits", dmu_dsa_nMuonHits, 'I');
+    bookTrackArray("dmu_dsa_nValidMuonHits", dmu_dsa_nValidMuonHits, 'I');
+    bookTrackArray("dmu_dsa_nValidMuonDTHits", dmu_dsa_nValidMuonDTHits, 'I');
+    bookTrackArray("dmu_dsa_nValidMuonCSCHits", dmu_dsa_nValidMuonCSCHits, 'I');
+    bookTrackArray("dmu_dsa_nValidMuonRPCHits", dmu_dsa_nValidMuonRPCHits, 'I');
+    bookTrackArray("dmu_dsa_nValidStripHits", dmu_dsa_nValidStripHits, 'I');
+    bookTrackArray("dmu_dsa_nhits", dmu_dsa_nhits, 'I');
+    bookTrackArray("dmu_dsa_dtStationsWithValidHits", dmu_dsa_dtStationsWithValidHits, 'I');
+    bookTrackArray("dmu_dsa_cscStationsWithValidHits", dmu_dsa_cscStationsWithValidHits, 'I');
+    bookTrackArray("dmu_dsa_nsegments", dmu_dsa_nsegments, 'I');
+    bookTrackArray("dmu_dsa_passTagID", dmu_dsa_passTagID, 'O');
+    bookTrackArray("dmu_dsa_hasProbe", dmu_dsa_hasProbe, 'O');
+    bookTrackArray("dmu_dsa_probeID", dmu_dsa_probeID, 'I');
+    bookTrackArray("dmu_dsa_cosAlpha", dmu_dsa_cosAlpha, 'F');
+    if (findDuplicateDSA) {
+        bookTrackArray("dmu_dsa_isDuplicate", dmu_dsa_isDuplicate, 'O');
+        bookTrackArray("dmu_dsa_representative", dmu_dsa_representative, 'I');
+    }
     // dmu_dgl
-    tree_out->Branch("dmu_dgl_pt", dmu_dgl_pt, "dmu_dgl_pt[ndmu]/F");
-    tree_out->Branch("dmu_dgl_eta", dmu_dgl_eta, "dmu_dgl_eta[ndmu]/F");
-    tree_out->Branch("dmu_dgl_phi", dmu_dgl_phi, "dmu_dgl_phi[ndmu]/F");
-    tree_out->Branch("dmu_dgl_ptError", dmu_dgl_ptError, "dmu_dgl_ptError[ndmu]/F");
-    tree_out->Branch("dmu_dgl_dxy", dmu_dgl_dxy, "dmu_dgl_dxy[ndmu]/F");
-    tree_out->Branch("dmu_dgl_dz", dmu_dgl_dz, "dmu_dgl_dz[ndmu]/F");
-    tree_out->Branch("dmu_dgl_normalizedChi2", dmu_dgl_normalizedChi2,
-                     "dmu_dgl_normalizedChi2[ndmu]/F");
-    tree_out->Branch("dmu_dgl_charge", dmu_dgl_charge, "dmu_dgl_charge[ndmu]/F");
-    tree_out->Branch("dmu_dgl_nMuonHits", dmu_dgl_nMuonHits, "dmu_dgl_nMuonHits[ndmu]/I");
-    tree_out->Branch("dmu_dgl_nValidMuonHits", dmu_dgl_nValidMuonHits,
-                     "dmu_dgl_nValidMuonHits[ndmu]/I");
-    tree_out->Branch("dmu_dgl_nValidMuonDTHits", dmu_dgl_nValidMuonDTHits,
-                     "dmu_dgl_nValidMuonDTHits[ndmu]/I");
-    tree_out->Branch("dmu_dgl_nValidMuonCSCHits", dmu_dgl_nValidMuonCSCHits,
-                     "dmu_dgl_nValidMuonCSCHits[ndmu]/I");
-    tree_out->Branch("dmu_dgl_nValidMuonRPCHits", dmu_dgl_nValidMuonRPCHits,
-                     "dmu_dgl_nValidMuonRPCHits[ndmu]/I");
-    tree_out->Branch("dmu_dgl_nValidStripHits", dmu_dgl_nValidStripHits,
-                     "dmu_dgl_nValidStripHits[ndmu]/I");
-    tree_out->Branch("dmu_dgl_nhits", dmu_dgl_nhits, "dmu_dgl_nhits[ndmu]/I");
-    tree_out->Branch("dmu_dgl_passTagID", dmu_dgl_passTagID, "dmu_dgl_passTagID[ndmu]/O");
-    tree_out->Branch("dmu_dgl_hasProbe", dmu_dgl_hasProbe, "dmu_dgl_hasProbe[ndmu]/O");
-    tree_out->Branch("dmu_dgl_probeID", dmu_dgl_probeID, "dmu_dgl_probeID[ndmu]/I");
-    tree_out->Branch("dmu_dgl_cosAlpha", dmu_dgl_cosAlpha, "dmu_dgl_cosAlpha[ndmu]/F");
+    bookTrackArray("dmu_dgl_pt", dmu_dgl_pt, 'F');
+    bookTrackArray("dmu_dgl_eta", dmu_dgl_eta, 'F');
+    bookTrackArray("dmu_dgl_phi", dmu_dgl_phi, 'F');
+    bookTrackArray("dmu_dgl_ptError", dmu_dgl_ptError, 'F');
+    bookTrackArray("dmu_dgl_dxy", dmu_dgl_dxy, 'F');
+    bookTrackArray("dmu_dgl_dz", dmu_dgl_dz, 'F');
+    bookTrackArray("dmu_dgl_normalizedChi2", dmu_dgl_normalizedChi2, 'F');
+    bookTrackArray("dmu_dgl_charge", dmu_dgl_charge, 'F');
+    bookTrackArray("dmu_dgl_nMuonHits", dmu_dgl_nMuonHits, 'I');
+    bookTrackArray("dmu_dgl_nValidMuonHits", dmu_dgl_nValidMuonHits, 'I');
+    bookTrackArray("dmu_dgl_nValidMuonDTHits", dmu_dgl_nValidMuonDTHits, 'I');
+    bookTrackArray("dmu_dgl_nValidMuonCSCHits", dmu_dgl_nValidMuonCSCHits, 'I');
+    bookTrackArray("dmu_dgl_nValidMuonRPCHits", dmu_dgl_nValidMuonRPCHits, 'I');
+    bookTrackArray("dmu_dgl_nValidStripHits", dmu_dgl_nValidStripHits, 'I');
+    bookTrackArray("dmu_dgl_nhits", dmu_dgl_nhits, 'I');
+    bookTrackArray("dmu_dgl_passTagID", dmu_dgl_passTagID, 'O');
+    bookTrackArray("dmu_dgl_hasProbe", dmu_dgl_hasProbe, 'O');
+    bookTrackArray("dmu_dgl_probeID", dmu_dgl_probeID, 'I');
+    bookTrackArray("dmu_dgl_cosAlpha", dmu_dgl_cosAlpha, 'F');
+    // dmu_dtk (only stored as a jagged collection)
+    if (jaggedLayout) {
+        bookTrackArray("dmu_dtk_pt", dmu_dtk_pt, 'F');
+        bookTrackArray("dmu_dtk_eta", dmu_dtk_eta, 'F');
+        bookTrackArray("dmu_dtk_phi", dmu_dtk_phi, 'F');
+        bookTrackArray("dmu_dtk_ptError", dmu_dtk_ptError, 'F');
+        bookTrackArray("dmu_dtk_dxy", dmu_dtk_dxy, 'F');
+        bookTrackArray("dmu_dtk_dz", dmu_dtk_dz, 'F');
+        bookTrackArray("dmu_dtk_normalizedChi2", dmu_dtk_normalizedChi2, 'F');
+        bookTrackArray("dmu_dtk_charge", dmu_dtk_charge, 'F');
+        bookTrackArray("dmu_dtk_nValidStripHits", dmu_dtk_nValidStripHits, 'I');
+        bookTrackArray("dmu_dtk_nhits", dmu_dtk_nhits, 'I');
+    }
 
     // Trigger branches
     for (unsigned int ihlt = 0; ihlt < HLTPaths_.size(); ihlt++) {
@@ -405,40 +1020,245 @@ void my_ntuplizer::beginJob() {
     // ----------------------------------
     // additional variables by Marco
     // ----------------------------------
-    tree_out->Branch("dmu_t0_InOut", dmu_t0_InOut, "dmu_t0_InOut[ndmu]/F");
-    tree_out->Branch("dmu_t0_OutIn", dmu_t0_OutIn, "dmu_t0_OutIn[ndmu]/F");
-    tree_out->Branch("dmu_dsa_isProbe", dmu_dsa_isProbe, "dmu_dsa_isProbe[ndmu]/O");
-    tree_out->Branch("dmu_dgl_isProbe", dmu_dgl_isProbe, "dmu_dgl_isProbe[ndmu]/O");
+    bookArray(tree_out, "dmu_t0_InOut", dmu_t0_InOut, 'F', "ndmu", &ndmu);
+    bookArray(tree_out, "dmu_t0_OutIn", dmu_t0_OutIn, 'F', "ndmu", &ndmu);
+    bookTrackArray("dmu_dsa_isProbe", dmu_dsa_isProbe, 'O');
+    bookTrackArray("dmu_dgl_isProbe", dmu_dgl_isProbe, 'O');
     // LLP gen matching
-    tree_out->Branch("dmu_dsa_genMatched", dmu_dsa_genMatched, "dmu_dsa_genMatched[ndmu]/O");
-    tree_out->Branch("dmu_dgl_genMatched", dmu_dgl_genMatched, "dmu_dgl_genMatched[ndmu]/O");
-    tree_out->Branch("dmu_dsa_genMatchingMultiplicity", dmu_dsa_genMatchingMultiplicity,
-                     "dmu_dsa_genMatchingMultiplicity[ndmu]/I");
-    tree_out->Branch("dmu_dgl_genMatchingMultiplicity", dmu_dgl_genMatchingMultiplicity,
-                     "dmu_dgl_genMatchingMultiplicity[ndmu]/I");
-    tree_out->Branch("dmu_dsa_genMatchingDeltaR", dmu_dsa_genMatchingDeltaR,
-                     "dmu_dsa_genMatchingDeltaR[ndmu]/F");
-    tree_out->Branch("dmu_dgl_genMatchingDeltaR", dmu_dgl_genMatchingDeltaR,
-                     "dmu_dgl_genMatchingDeltaR[ndmu]/F");
-    tree_out->Branch("dmu_dsa_genMatchedID", dmu_dsa_genMatchedID, "dmu_dsa_genMatchedID[ndmu]/I");
-    tree_out->Branch("dmu_dgl_genMatchedID", dmu_dgl_genMatchedID, "dmu_dgl_genMatchedID[ndmu]/I");
+    bookTrackArray("dmu_dsa_genMatched", dmu_dsa_genMatched, 'O');
+    bookTrackArray("dmu_dgl_genMatched", dmu_dgl_genMatched, 'O');
+    bookTrackArray("dmu_dsa_genMatchingMultiplicity", dmu_dsa_genMatchingMultiplicity, 'I');
+    bookTrackArray("dmu_dgl_genMatchingMultiplicity", dmu_dgl_genMatchingMultiplicity, 'I');
+    bookTrackArray("dmu_dsa_genMatchingDeltaR", dmu_dsa_genMatchingDeltaR, 'F');
+    bookTrackArray("dmu_dgl_genMatchingDeltaR", dmu_dgl_genMatchingDeltaR, 'F');
+    bookTrackArray("dmu_dsa_genMatchedID", dmu_dsa_genMatchedID, 'I');
+    bookTrackArray("dmu_dgl_genMatchedID", dmu_dgl_genMatchedID, 'I');
+    // Propagation to detector surfaces
+    for (unsigned int isurf = 0; isurf < propagationSurfaces.size(); isurf++) {
+        for (auto type : {"dsa", "dgl"}) {
+            PropagationResult& result = (std::string(type) == "dsa") ? dmu_dsa_propagation[isurf]
+                                                                      : dmu_dgl_propagation[isurf];
+            TString prefix =
+                TString::Format("dmu_%s_%s", type, propagationSurfaces[isurf].name.c_str());
+            bookTrackArray(prefix + "_x", result.x, 'F');
+            bookTrackArray(prefix + "_y", result.y, 'F');
+            bookTrackArray(prefix + "_z", result.z, 'F');
+            bookTrackArray(prefix + "_path", result.path, 'F');
+            bookTrackArray(prefix + "_pass", result.pass, 'O');
+        }
+    }
     gen_tree_out->Branch("ngenmu", &ngenmu, "ngenmu/I");
     gen_tree_out->Branch("genmu_genMatched", genmu_genMatched, "genmu_genMatched[ngenmu]/O");
-    gen_tree_out->Branch("genmu_lxy", genmu_lxy, "genmu_lxy[ngenmu]/F");
-    gen_tree_out->Branch("genmu_lz", genmu_lz, "genmu_lz[ngenmu]/F");
-    gen_tree_out->Branch("genmu_pt", genmu_pt, "genmu_pt[ngenmu]/F");
-    gen_tree_out->Branch("genmu_eta", genmu_eta, "genmu_eta[ngenmu]/F");
-    gen_tree_out->Branch("genmu_phi", genmu_phi, "genmu_phi[ngenmu]/F");
+    bookArray(gen_tree_out, "genmu_lxy", genmu_lxy, 'F', "ngenmu", &ngenmu);
+    bookArray(gen_tree_out, "genmu_lz", genmu_lz, 'F', "ngenmu", &ngenmu);
+    bookArray(gen_tree_out, "genmu_pt", genmu_pt, 'F', "ngenmu", &ngenmu);
+    bookArray(gen_tree_out, "genmu_eta", genmu_eta, 'F', "ngenmu", &ngenmu);
+    bookArray(gen_tree_out, "genmu_phi", genmu_phi, 'F', "ngenmu", &ngenmu);
+
+    // Every policy must refer to a booked branch, by its aligned name in the jagged layout too
+    for (const auto& policy : precisionPolicies) {
+        const std::string& name = policy.first;
+        bool jaggedAlias = jaggedLayout && name.compare(0, 4, "dmu_") == 0 &&
+                           tree_out->GetBranch(name.substr(4).c_str());
+        if (!tree_out->GetBranch(name.c_str()) && !gen_tree_out->GetBranch(name.c_str()) &&
+            !jaggedAlias) {
+            throw cms::Exception("Configuration")
+                << "Precision policy given for unknown branch '" << policy.first << "'";
+        }
+    }
+}
+
+// Book an array branch of Float_t ('F') or Int_t ('I') honouring the precision policies, given
+// for its name or else for its alias (the aligned name of a jagged branch)
+void my_ntuplizer::bookArray(TTree* tree, const char* name, void* values, char type,
+                             const char* sizeName, Int_t* size, const char* alias) {
+    auto it = precisionPolicies.find(name);
+    if (it == precisionPolicies.end() && alias) { it = precisionPolicies.find(alias); }
+    if (it == precisionPolicies.end() || it->second.kind == precision::Kind::Full) {
+        tree->Branch(name, values, TString::Format("%s[%s]/%c", name, sizeName, type));
+        return;
+    }
+    const precision::Policy& policy = it->second;
+    if (type != 'F' && !precision::isNarrowing(policy)) {
+        throw cms::Exception("Configuration")
+            << "Float16 precision policy given for integer branch '" << name << "'";
+    }
+    // The record (and narrowed buffer) is kept when booking again after a rollover
+    precision::BranchRecord* record = nullptr;
+    for (auto& booked : precisionBranches) {
+        if (booked.tree == tree->GetName() && booked.name == name) { record = &booked; }
+    }
+    if (!record) {
+        precisionBranches.emplace_back();
+        record = &precisionBranches.back();
+        record->tree = tree->GetName();
+        record->name = name;
+        record->policy = policy;
+        record->bookedType = type;
+        record->values = values;
+        record->size = size;
+        // The analyzer keeps filling its own buffer, the narrowed copy is made before each Fill
+        record->narrowed.resize(200 * precision::narrowSize(policy));
+    }
+    tree->Branch(name, record->narrowed.empty() ? values : record->narrowed.data(),
+                 TString::Format("%s[%s]/%s", name, sizeName,
+                                 precision::leafType(policy, type).c_str()));
+}
+
+// Book a dmu_<type>_* array, aligned to ndmu or as <type>_* in the jagged collection of its type
+void my_ntuplizer::bookTrackArray(const char* name, void* values, char type) {
+    TrackCollection* collection = nullptr;
+    for (auto& candidate : trackCollections) {
+        if (std::strncmp(name + 4, candidate.type.c_str(), 3) == 0) { collection = &candidate; }
+    }
+    if (!collection) {
+        if (type == 'O') {
+            tree_out->Branch(name, values, TString::Format("%s[ndmu]/O", name));
+        } else {
+            bookArray(tree_out, name, values, type, "ndmu", &ndmu);
+        }
+        return;
+    }
+    TString jaggedName = name + 4;
+    TString counter = "n" + collection->type;
+    size_t size = type == 'O' ? sizeof(bool) : sizeof(Int_t);
+    void* compact = collection->field(values, size).values.data();
+    if (type == 'O') {
+        tree_out->Branch(jaggedName, compact, jaggedName + "[" + counter + "]/O");
+    } else {
+        bookArray(tree_out, jaggedName, compact, type, counter, &collection->n, name);
+    }
+}
+
+// The time between two consecutive stopStage() calls is attributed to the stage being stopped
+void my_ntuplizer::startStages() {
+    if (!timeStages) { return; }
+    nTimedEvents++;
+    stageStart = std::chrono::steady_clock::now();
+}
+
+void my_ntuplizer::stopStage(Stage stage) {
+    if (!timeStages) { return; }
+    auto now = std::chrono::steady_clock::now();
+    stageTime[stage] += std::chrono::duration<double>(now - stageStart).count();
+    stageStart = now;
+}
+
+void my_ntuplizer::printStageReport() const {
+    if (!timeStages || nTimedEvents == 0) { return; }
+    std::cout << "Stage timing (" << nTimedEvents << " events)" << std::endl;
+    std::cout << std::left << std::setw(16) << "stage" << std::right << std::setw(14)
+              << "total [s]" << std::setw(16) << "per event [us]" << std::endl;
+    for (int stage = 0; stage < kNStages; stage++) {
+        std::cout << std::left << std::setw(16) << stageNames[stage] << std::right
+                  << std::setw(14) << stageTime[stage] << std::setw(16)
+                  << 1e6 * stageTime[stage] / nTimedEvents << std::endl;
+    }
+}
+
+// Propagate a batch of tracks to all the configured surfaces. The trajectory states are built
+// once per track and the surfaces and propagator are shared by the whole batch
+void my_ntuplizer::propagateToSurfaces(
+    const std::vector<std::pair<unsigned int, const reco::Track*>>& batch,
+    std::vector<PropagationResult>& results, const Propagator* propagator,
+    const MagneticField* magField) {
+    std::vector<FreeTrajectoryState> states;
+    states.reserve(batch.size());
+    for (const auto& entry : batch) {
+        const reco::Track* track = entry.second;
+        states.emplace_back(GlobalPoint(track->vx(), track->vy(), track->vz()),
+                            GlobalVector(track->px(), track->py(), track->pz()),
+                            track->charge(), magField);
+    }
+    for (unsigned int isurf = 0; isurf < propagationSurfaces.size(); isurf++) {
+        const PropagationSurface& surface = propagationSurfaces[isurf];
+        PropagationResult& result = results[isurf];
+        for (unsigned int k = 0; k < batch.size(); k++) {
+            unsigned int i = batch[k].first;
+            const FreeTrajectoryState& fts = states[k];
+            if (!passStraightLineAcceptance(surface, fts.position(), fts.momentum(),
+                                            propagationMargin)) {
+                continue;
+            }
+            TsosPath tsosPath = surface.isCylinder
+                                    ? propagator->propagateWithPath(fts, *surface.cylinder)
+                                    : propagator->propagateWithPath(fts, *surface.plane);
+            if (!tsosPath.first.isValid()) { continue; }
+            GlobalPoint position = tsosPath.first.globalPosition();
+            result.x[i] = position.x();
+            result.y[i] = position.y();
+            result.z[i] = position.z();
+            result.path[i] = tsosPath.second;
+            if (surface.isCylinder) {
+                result.pass[i] = position.z() >= surface.minZ && position.z() <= surface.maxZ;
+            } else {
+                result.pass[i] = position.perp() >= surface.minR && position.perp() <= surface.maxR;
+            }
+        }
+    }
+}
+
+// Narrow the values and record the quantization error of the branches of a tree before filling it
+void my_ntuplizer::updatePrecision(const TTree* tree) {
+    for (auto& record : precisionBranches) {
+        if (record.tree == tree->GetName()) { record.update(); }
+    }
+}
+
+// Collect the bytes written for the branches of a tree (before the tree is closed)
+void my_ntuplizer::harvestPrecision(const TTree* tree) {
+    for (auto& record : precisionBranches) {
+        if (record.tree != tree->GetName()) { continue; }
+        TBranch* branch = tree->GetBranch(record.name.c_str());
+        record.totBytes += branch->GetTotBytes();
+        record.zipBytes += branch->GetZipBytes();
+    }
+}
+
+// Size saved and maximum quantization error per branch
+void my_ntuplizer::printPrecisionReport() const {
+    if (precisionBranches.empty()) { return; }
+    // The full precision size is the stored one with 4 byte values, so that both include the
+    // same entry offsets and basket headers
+    std::cout << "Precision report (full = stored bytes with 4 bytes/value, before compression)"
+              << std::endl;
+    std::cout << std::left << std::setw(36) << "branch" << std::right << std::setw(12) << "values"
+              << std::setw(14) << "full [B]" << std::setw(14) << "stored [B]" << std::setw(14)
+              << "zipped [B]" << std::setw(14) << "max |err|" << std::setw(14) << "max rel err"
+              << std::endl;
+    for (const auto& record : precisionBranches) {
+        std::cout << std::left << std::setw(36) << record.name << std::right << std::setw(12)
+                  << record.stats.nValues << std::setw(14)
+                  << record.totBytes +
+                         Long64_t(record.stats.nValues) * (4 - precision::storedSize(record.policy))
+                  << std::setw(14) << record.totBytes << std::setw(14) << record.zipBytes
+                  << std::setw(14) << record.stats.maxAbsError << std::setw(14)
+                  << record.stats.maxRelError << std::endl;
+    }
 }
 
 // endJob (After event loop has finished)
 void my_ntuplizer::endJob() {
     std::cout << "End Job" << std::endl;
-    file_out->cd();
-    tree_out->Write();
-    gen_tree_out->Write();
-    counts->Write();
-    file_out->Close();
+    // Lumis and runs ending after the last rollover get a last file without events
+    if (!file_out && (!pendingLumis.empty() || !pendingRuns.empty())) { openOutputFile(); }
+    if (file_out) { closeOutputFile(); }
+    if (columnarEvents) {
+        columnarEvents->close();
+        columnarGen->close();
+    }
+    if (asyncWriter) {
+        std::cout << "Writer thread: " << asyncWriter->nPushed() << " entries, queue depth mean "
+                  << asyncWriter->meanDepth() << " max " << asyncWriter->maxDepth()
+                  << ", analyzer stalled " << asyncWriter->stallSeconds() << " s" << std::endl;
+        asyncWriter.reset();
+    }
+    if (findDuplicateDSA) {
+        std::cout << "Duplicate DSA pairs (shared segment fraction >= " << duplicateSharedFraction
+                  << "): " << nDuplicateDSA << std::endl;
+    }
+    printPrecisionReport();
+    printStageReport();
 }
 
 // fillDescriptions
@@ -450,21 +1270,44 @@ void my_ntuplizer::fillDescriptions(edm::ConfigurationDescriptions& descriptions
 
 // Analyze (per event)
 void my_ntuplizer::analyze(const edm::Event& iEvent, const edm::EventSetup& iSetup) {
+    startStages();
     iEvent.getByToken(dmuToken, dmuons);
     iEvent.getByToken(triggerBits_, triggerBits);
-    const Propagator* propagatorAlong = &iSetup.getData(thePropAlongToken);
-    const MagneticField* magField = propagatorAlong->magneticField();
+    const Propagator* propagatorAlong = nullptr;
+    const MagneticField* magField = nullptr;
+    if (thePropAlongToken.isInitialized()) {
+        propagatorAlong = &iSetup.getData(thePropAlongToken);
+        magField = propagatorAlong->magneticField();
+    }
     passTrackerPointing = false;
-    
-
-    // Count number of events read
-    counts->Fill(0);
 
     // -> Event info
     event = iEvent.id().event();
     lumiBlock = iEvent.id().luminosityBlock();
     run = iEvent.id().run();
 
+    // Start a new file when the previous one was closed by a rollover
+    bool newLumi = fileEvents == 0 || run != lastRun || lumiBlock != lastLumi;
+    if (!file_out) { openOutputFile(); }
+    if (fileEvents == 0) {
+        firstRun = run;
+        firstLumi = lumiBlock;
+        firstEvent = event;
+        newLumi = true;
+    }
+    if (newLumi) { fileLumis++; }
+    lastRun = run;
+    lastLumi = lumiBlock;
+    lastEvent = event;
+    fileEvents++;
+    lumiOpen = true;
+    runOpen = true;
+
+    // Count number of events read
+    counts->Fill(0);
+    SummaryCounters::increment(lumiCounters.eventsSeen);
+    stopStage(kSetup);
+
     // ----------------------------------
     // LLP Signal - Gen Matching
     // ----------------------------------
@@ -494,6 +1337,7 @@ void my_ntuplizer::analyze(const edm::Event& iEvent, const edm::EventSetup& iSet
                     ) {
                         continue;
                     }
+                    if (ngenmu >= kMaxGenMuons) { break; }
                     float dR = reco::deltaR(*globalTrack, genPart);
                     if (dR < 0.5) {
                         dmu_dgl_genMatched[ndmu] = true;
@@ -517,6 +1361,7 @@ void my_ntuplizer::analyze(const edm::Event& iEvent, const edm::EventSetup& iSet
                     ) {
                         continue;
                     }
+                    if (ngenmu >= kMaxGenMuons) { break; }
                     float dR = reco::deltaR(*outerTrack, genPart);
                     if (dR < 0.5) {
                         dmu_dsa_genMatched[ndmu] = true;
@@ -541,6 +1386,7 @@ void my_ntuplizer::analyze(const edm::Event& iEvent, const edm::EventSetup& iSet
             ) {
                 continue;
             }
+            if (ngenmu >= kMaxGenMuons) { break; }
             genmu_genMatched[ngenmu] = false;
             // A gen muon is gen matched if its index is anywhere in the
             //  dmu_dsa/dgl_genMatchedID array
@@ -563,33 +1409,39 @@ void my_ntuplizer::analyze(const edm::Event& iEvent, const edm::EventSetup& iSet
 
             ngenmu++;
         }
-        gen_tree_out->Fill();
+        updatePrecision(gen_tree_out);
+        fillTree(gen_tree_out);
+        if (columnarGen) { columnarGen->fill(); }
     }
-
-
+    stopStage(kGenMatching);
 
     // ----------------------------------
     // MC cosmics - gen information
     // ----------------------------------
     //The point of this is to have information on the vertex of the gen muons
     //of the cosmics to make appropriate event level cuts e.g. for global muons
-    if (isCosmics) {
+    if (isCosmics && !prunedGenToken.isUninitialized()) {
         iEvent.getByToken(prunedGenToken, prunedGen);
+    }
+    if (isCosmics && prunedGen.isValid()) {
         ngenmu = 0;
         for (unsigned int j = 0; j < prunedGen->size(); j++) {
             const reco::GenParticle& genPart(prunedGen->at(j));
             if (genPart.status() != 1 || abs(genPart.pdgId()) != 13) {
                 continue;  // Only consider stable muons
             }
+            if (ngenmu >= kMaxGenMuons) { break; }
             genmu_genMatched[ngenmu] = false;
             genmu_lxy[ngenmu] = XYZVector(genPart.vx(), genPart.vy(), genPart.vz()).rho();
             genmu_lz[ngenmu] = genPart.vz();
             genmu_pt[ngenmu] = genPart.pt();
             genmu_eta[ngenmu] = genPart.eta();
             genmu_phi[ngenmu] = genPart.phi();
+            ngenmu++;
             // ----------------------------------
             // MC cosmics - propagation
             // ----------------------------------
+            if (!computeTrackerPointing) { continue; }
             GlobalPoint genVertex(genPart.vx(), genPart.vy(), genPart.vz());
             GlobalVector genMomentum(genPart.px(), genPart.py(), genPart.pz());
             int genCharge = genPart.charge();
@@ -609,13 +1461,20 @@ void my_ntuplizer::analyze(const edm::Event& iEvent, const edm::EventSetup& iSet
                     passTrackerPointing = true;
                 }
             } 
-            ngenmu++;
         }
-        gen_tree_out->Fill();
+        updatePrecision(gen_tree_out);
+        fillTree(gen_tree_out);
+        if (columnarGen) { columnarGen->fill(); }
     }
+    stopStage(kCosmicsGen);
+
     // ----------------------------------
     // displacedMuons Collection
     // ----------------------------------
+    if (findDuplicateDSA) {
+        dsaSignatures.assign(dmuons->size(), overlap::Signature());
+        dsaQuality.assign(dmuons->size(), 0.);
+    }
     ndmu = 0;
     for (unsigned int i = 0; i < dmuons->size(); i++) {
         // std::cout << " - - ndmu: " << ndmu << std::endl;
@@ -653,7 +1512,7 @@ void my_ntuplizer::analyze(const edm::Event& iEvent, const edm::EventSetup& iSet
             dmu_dgl_nValidMuonRPCHits[ndmu] = globalTrack->hitPattern().numberOfValidMuonRPCHits();
             dmu_dgl_nValidStripHits[ndmu] = globalTrack->hitPattern().numberOfValidStripHits();
             dmu_dgl_nhits[ndmu] = globalTrack->hitPattern().numberOfValidHits();
-        } else {
+        } else if (!jaggedLayout) {
             dmu_dgl_pt[ndmu] = 0;
             dmu_dgl_eta[ndmu] = 0;
             dmu_dgl_phi[ndmu] = 0;
@@ -705,11 +1564,20 @@ void my_ntuplizer::analyze(const edm::Event& iEvent, const edm::EventSetup& iSet
                     if (id.det() != DetId::Muon) continue;
                     if (id.subdetId() == MuonSubdetId::DT || id.subdetId() == MuonSubdetId::CSC) {
                         nsegments++;
+                        if (findDuplicateDSA) {
+                            LocalPoint position = (*hit)->localPosition();
+                            dsaSignatures[i].push_back(
+                                overlap::segmentKey(id.rawId(), position.x(), position.y()));
+                        }
                     }
                 }
                 dmu_dsa_nsegments[ndmu] = nsegments;
+                if (findDuplicateDSA) {
+                    overlap::finalize(dsaSignatures[i]);
+                    dsaQuality[i] = outerTrack->normalizedChi2();
+                }
             }
-        } else {
+        } else if (!jaggedLayout) {
             dmu_dsa_pt[ndmu] = 0;
             dmu_dsa_eta[ndmu] = 0;
             dmu_dsa_phi[ndmu] = 0;
@@ -731,9 +1599,72 @@ void my_ntuplizer::analyze(const edm::Event& iEvent, const edm::EventSetup& iSet
             dmu_dsa_nsegments[ndmu] = 0;
         }
 
+        // Access the DTK track associated to the displacedMuon (jagged layout only)
+        if (jaggedLayout) {
+            const reco::TrackRef innerTrack = dmuon.innerTrack();
+            dmu_hasDTK[ndmu] = innerTrack.isNonnull() && innerTrack.isAvailable();
+            if (dmu_hasDTK[ndmu]) {
+                dmu_dtk_pt[ndmu] = innerTrack->pt();
+                dmu_dtk_eta[ndmu] = innerTrack->eta();
+                dmu_dtk_phi[ndmu] = innerTrack->phi();
+                dmu_dtk_ptError[ndmu] = innerTrack->ptError();
+                dmu_dtk_dxy[ndmu] = innerTrack->dxy();
+                dmu_dtk_dz[ndmu] = innerTrack->dz();
+                dmu_dtk_normalizedChi2[ndmu] = innerTrack->normalizedChi2();
+                dmu_dtk_charge[ndmu] = innerTrack->charge();
+                dmu_dtk_nValidStripHits[ndmu] = innerTrack->hitPattern().numberOfValidStripHits();
+                dmu_dtk_nhits[ndmu] = innerTrack->hitPattern().numberOfValidHits();
+            }
+        }
+
         ndmu++;
         // std::cout << "End muon" << std::endl;
     }
+    stopStage(kMuons);
+
+    // ----------------------------------
+    // Duplicate DSA tracks (shared DT/CSC segments)
+    // ----------------------------------
+    if (findDuplicateDSA) {
+        nDuplicateDSA += overlap::resolve(dsaSignatures, dsaQuality, duplicateSharedFraction,
+                                          dsaRepresentative);
+        for (int i = 0; i < ndmu; i++) {
+            // DSAs without hits (MiniAOD) represent themselves
+            if (dmu_isDSA[i] && dsaRepresentative[i] < 0) { dsaRepresentative[i] = i; }
+            dmu_dsa_representative[i] = dsaRepresentative[i];
+            dmu_dsa_isDuplicate[i] = dsaRepresentative[i] >= 0 && dsaRepresentative[i] != i;
+        }
+    }
+    auto pairableDSA = [this](unsigned int k) {
+        return !(findDuplicateDSA && excludeDuplicateDSA && dmu_dsa_isDuplicate[k]);
+    };
+    stopStage(kOverlap);
+
+    // ----------------------------------
+    // Propagation of DSA/DGL tracks to detector surfaces
+    // ----------------------------------
+    if (!propagationSurfaces.empty()) {
+        std::vector<std::pair<unsigned int, const reco::Track*>> dsaBatch, dglBatch;
+        for (unsigned int i = 0; i < dmuons->size(); i++) {
+            const reco::Muon& dmuon(dmuons->at(i));
+            if (dmuon.isStandAloneMuon()) {
+                dsaBatch.emplace_back(i, dmuon.standAloneMuon().get());
+            }
+            if (dmuon.isGlobalMuon()) { dglBatch.emplace_back(i, dmuon.combinedMuon().get()); }
+        }
+        for (unsigned int isurf = 0; isurf < propagationSurfaces.size(); isurf++) {
+            for (auto* result : {&dmu_dsa_propagation[isurf], &dmu_dgl_propagation[isurf]}) {
+                std::fill_n(result->x, ndmu, 0.);
+                std::fill_n(result->y, ndmu, 0.);
+                std::fill_n(result->z, ndmu, 0.);
+                std::fill_n(result->path, ndmu, 0.);
+                std::fill_n(result->pass, ndmu, false);
+            }
+        }
+        propagateToSurfaces(dsaBatch, dmu_dsa_propagation, propagatorAlong, magField);
+        propagateToSurfaces(dglBatch, dmu_dgl_propagation, propagatorAlong, magField);
+    }
+    stopStage(kPropagation);
 
     // ----------------------------------
     // Tag and probe code - Cosmics only
@@ -791,7 +1722,7 @@ void my_ntuplizer::analyze(const edm::Event& iEvent, const edm::EventSetup& iSet
                         }
                     }
                 }
-            } else {
+            } else if (!jaggedLayout) {
                 dmu_dgl_passTagID[ndmu] = false;
                 dmu_dgl_hasProbe[ndmu] = false;
                 dmu_dgl_probeID[ndmu] = 0;
@@ -808,7 +1739,7 @@ void my_ntuplizer::analyze(const edm::Event& iEvent, const edm::EventSetup& iSet
                 dmu_dsa_probeID[ndmu] = 0;
                 dmu_dsa_cosAlpha[ndmu] = 0.;
                 // Check if muon passes tag ID
-                dmu_dsa_passTagID[ndmu] = passTagID(outerTrack, "DSA");
+                dmu_dsa_passTagID[ndmu] = passTagID(outerTrack, "DSA") && pairableDSA(i);
                 if (dmu_dsa_passTagID[ndmu]) {
                     // Search probe
                     XYZVector v_tag =
@@ -820,6 +1751,7 @@ void my_ntuplizer::analyze(const edm::Event& iEvent, const edm::EventSetup& iSet
                         if (i == j) { continue; }
                         const reco::Muon& muonProbeCandidate(dmuons->at(j));
                         if (!muonProbeCandidate.isStandAloneMuon()) { continue; }  // Get only dsas
+                        if (!pairableDSA(j)) { continue; }
                         const reco::Track* trackProbeCandidate =
                             (muonProbeCandidate.standAloneMuon()).get();
                         if (passProbeID(trackProbeCandidate, v_tag, "DSA")) {
@@ -846,7 +1778,7 @@ void my_ntuplizer::analyze(const edm::Event& iEvent, const edm::EventSetup& iSet
                         }
                     }
                 }
-            } else {
+            } else if (!jaggedLayout) {
                 dmu_dsa_passTagID[ndmu] = false;
                 dmu_dsa_hasProbe[ndmu] = false;
                 dmu_dsa_probeID[ndmu] = 0;
@@ -865,7 +1797,25 @@ void my_ntuplizer::analyze(const edm::Event& iEvent, const edm::EventSetup& iSet
             }
             ndmu++;
         }
+        // Tag and probe bookkeeping
+        Long64_t dsaTags = 0, dsaProbes = 0, dglTags = 0, dglProbes = 0;
+        for (int i = 0; i < ndmu; i++) {
+            // Rows of missing tracks are not reset in the jagged layout
+            if (dmu_isDSA[i]) {
+                dsaTags += dmu_dsa_passTagID[i];
+                dsaProbes += dmu_dsa_hasProbe[i];
+            }
+            if (dmu_isDGL[i]) {
+                dglTags += dmu_dgl_passTagID[i];
+                dglProbes += dmu_dgl_hasProbe[i];
+            }
+        }
+        SummaryCounters::increment(lumiCounters.dsaTags, dsaTags);
+        SummaryCounters::increment(lumiCounters.dsaProbes, dsaProbes);
+        SummaryCounters::increment(lumiCounters.dglTags, dglTags);
+        SummaryCounters::increment(lumiCounters.dglProbes, dglProbes);
     }
+    stopStage(kTagAndProbe);
 
     // Check if trigger fired:
     const edm::TriggerNames& names = iEvent.triggerNames(*triggerBits);
@@ -881,11 +1831,26 @@ void my_ntuplizer::analyze(const edm::Event& iEvent, const edm::EventSetup& iSet
             fired = true;
         }
         triggerPass[ipath] = fired;
+        if (fired) { SummaryCounters::increment(lumiCounters.triggerFires[ipath]); }
         ipath++;
     }
+    stopStage(kTrigger);
 
     //-> Fill tree
-    tree_out->Fill();
+    for (auto& collection : trackCollections) { collection.gather(ndmu); }
+    updatePrecision(tree_out);
+    fillTree(tree_out);
+    if (columnarEvents) { columnarEvents->fill(); }
+    SummaryCounters::increment(lumiCounters.eventsWritten);
+    stopStage(kFill);
+
+    // Close the file as soon as it is complete
+    Long64_t zipBytes = asyncWriter ? asyncWriter->zipBytes()
+                                    : tree_out->GetZipBytes() + gen_tree_out->GetZipBytes();
+    if ((maxEventsPerFile > 0 && fileEvents >= maxEventsPerFile) ||
+        (maxFileSizeMB > 0 && zipBytes >= maxFileSizeMB * 1024 * 1024)) {
+        closeOutputFile();
+    }
 }
 
 DEFINE_FWK_MODULE(my_ntuplizer);
@@ -12,6 +12,7 @@ ntuples = cms.EDAnalyzer(
     prunedGenParticles=cms.InputTag("prunedGenParticles"),
     bits=cms.InputTag("TriggerResults", "", "HLT"),
     propagatorAlong=cms.string('SteppingHelixPropagatorAlong'),
+    computeTrackerPointing=cms.bool(True),
 )
 
 SteppingHelixPropagatorAlong = cms.ESProducer("SteppingHelixPropagatorESProducer",
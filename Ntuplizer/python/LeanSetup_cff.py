@@ -0,0 +1,13 @@
+import FWCore.ParameterSet.Config as cms
+
+# Minimal EventSetup of the ntuplizer: the 3.8 T volume based magnetic field (geometry read
+# from XML, no conditions database) and the SteppingHelixPropagatorAlong built on top of it.
+# It replaces GeometryDB_cff, MagneticField_38T_cff, FrontierConditions_GlobalTag_cff and
+# Reconstruction_cff for the jobs that only read the muons, TriggerResults and gen particles:
+#   process.load("DisplacedMuons-FrameWork-CosmicsAndLLP.Ntuplizer.LeanSetup_cff")
+#
+# The framework builds whatever the analyzer consumes before the first event, and the analyzer
+# only consumes the propagator when it propagates (computeTrackerPointing for the cosmics MC gen
+# muons, or propagationSurfaces). Otherwise nothing here is built.
+from MagneticField.Engine.volumeBasedMagneticField_160812_cfi import *
+from TrackPropagation.SteppingHelixPropagator.SteppingHelixPropagatorAlong_cfi import *
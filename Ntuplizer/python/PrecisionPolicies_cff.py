@@ -0,0 +1,80 @@
+import FWCore.ParameterSet.Config as cms
+
+# Reduced-precision storage for low-resolution branches.
+# Usage in a runNtuplizer cfg (the package name is not a valid identifier, hence importlib):
+#   import importlib
+#   policies = importlib.import_module(
+#       "DisplacedMuons-FrameWork-CosmicsAndLLP.Ntuplizer.PrecisionPolicies_cff"
+#   )
+#   process.ntuples.precisionPolicies = policies.precisionPolicies
+#
+# policy: "full", "float16" (min, max, nbits), "truncate" (nbits), "int8", "int16", "bool".
+# The maximum quantization error and the bytes written per branch are printed at the end of the job.
+precisionPolicies = cms.VPSet(
+    # Always +-1
+    cms.PSet(
+        branches=cms.vstring("dmu_dsa_charge", "dmu_dgl_charge"),
+        policy=cms.string("int8"),
+    ),
+    # 0/1 flags booked as Int_t
+    cms.PSet(
+        branches=cms.vstring("dmu_isDSA", "dmu_isDGL", "dmu_isDTK", "dmu_isMatchesValid"),
+        policy=cms.string("bool"),
+    ),
+    # Small counts
+    cms.PSet(
+        branches=cms.vstring(
+            "dmu_numberOfMatches",
+            "dmu_numberOfChambers",
+            "dmu_numberOfChambersCSCorDT",
+            "dmu_numberOfMatchedStations",
+            "dmu_numberOfMatchedRPCLayers",
+            "dmu_dsa_dtStationsWithValidHits",
+            "dmu_dsa_cscStationsWithValidHits",
+            "dmu_dsa_nsegments",
+            "dmu_dsa_genMatchingMultiplicity",
+            "dmu_dgl_genMatchingMultiplicity",
+        ),
+        policy=cms.string("int8"),
+    ),
+    # Hit counts
+    cms.PSet(
+        branches=cms.vstring(
+            "dmu_dsa_nMuonHits",
+            "dmu_dsa_nValidMuonHits",
+            "dmu_dsa_nValidMuonDTHits",
+            "dmu_dsa_nValidMuonCSCHits",
+            "dmu_dsa_nValidMuonRPCHits",
+            "dmu_dsa_nValidStripHits",
+            "dmu_dsa_nhits",
+            "dmu_dgl_nMuonHits",
+            "dmu_dgl_nValidMuonHits",
+            "dmu_dgl_nValidMuonDTHits",
+            "dmu_dgl_nValidMuonCSCHits",
+            "dmu_dgl_nValidMuonRPCHits",
+            "dmu_dgl_nValidStripHits",
+            "dmu_dgl_nhits",
+        ),
+        policy=cms.string("int16"),
+    ),
+    # Bounded in [-1, 1]
+    cms.PSet(
+        branches=cms.vstring("dmu_dsa_cosAlpha", "dmu_dgl_cosAlpha"),
+        policy=cms.string("float16"),
+        min=cms.double(-1.0),
+        max=cms.double(1.0),
+        nbits=cms.int32(14),
+    ),
+    # Either < 0.5 or the 9999 sentinel, 13 mantissa bits are the fewest storing 9999 exactly
+    cms.PSet(
+        branches=cms.vstring("dmu_dsa_genMatchingDeltaR", "dmu_dgl_genMatchingDeltaR"),
+        policy=cms.string("truncate"),
+        nbits=cms.int32(13),
+    ),
+    # Timing resolution is O(ns)
+    cms.PSet(
+        branches=cms.vstring("dmu_t0_InOut", "dmu_t0_OutIn"),
+        policy=cms.string("truncate"),
+        nbits=cms.int32(10),
+    ),
+)
@@ -0,0 +1,67 @@
+import FWCore.ParameterSet.Config as cms
+
+# Detector surfaces to which the reco DSA/DGL tracks are propagated (lengths in cm).
+# Usage in a runNtuplizer cfg (needs the propagatorAlong ESProducer):
+#   import importlib
+#   surfaces = importlib.import_module(
+#       "DisplacedMuons-FrameWork-CosmicsAndLLP.Ntuplizer.PropagationSurfaces_cff"
+#   )
+#   process.ntuples.propagationSurfaces = surfaces.propagationSurfaces
+#   process.ntuples.propagationMargin = surfaces.propagationMargin
+#
+# For every surface <name> the branches dmu_{dsa,dgl}_<name>_{x,y,z,path,pass} are written.
+propagationSurfaces = cms.VPSet(
+    cms.PSet(
+        name=cms.string("beamPipe"),
+        type=cms.string("cylinder"),
+        radius=cms.double(2.2),
+        minZ=cms.double(-300.0),
+        maxZ=cms.double(300.0),
+    ),
+    cms.PSet(
+        name=cms.string("pixelBarrel"),
+        type=cms.string("cylinder"),
+        radius=cms.double(16.0),
+        minZ=cms.double(-27.0),
+        maxZ=cms.double(27.0),
+    ),
+    cms.PSet(
+        name=cms.string("tibOuter"),
+        type=cms.string("cylinder"),
+        radius=cms.double(50.0),
+        minZ=cms.double(-70.0),
+        maxZ=cms.double(70.0),
+    ),
+    # Same acceptance as passTrackerPointing for gen muons
+    cms.PSet(
+        name=cms.string("trackerPointing"),
+        type=cms.string("cylinder"),
+        radius=cms.double(70.0),
+        minZ=cms.double(-60.0),
+        maxZ=cms.double(60.0),
+    ),
+    cms.PSet(
+        name=cms.string("tobOuter"),
+        type=cms.string("cylinder"),
+        radius=cms.double(110.0),
+        minZ=cms.double(-110.0),
+        maxZ=cms.double(110.0),
+    ),
+    cms.PSet(
+        name=cms.string("tecPlus"),
+        type=cms.string("disk"),
+        z=cms.double(280.0),
+        minR=cms.double(22.0),
+        maxR=cms.double(113.0),
+    ),
+    cms.PSet(
+        name=cms.string("tecMinus"),
+        type=cms.string("disk"),
+        z=cms.double(-280.0),
+        minR=cms.double(22.0),
+        maxR=cms.double(113.0),
+    ),
+)
+
+# Tracks whose straight-line extrapolation misses a surface by more than this are not propagated
+propagationMargin = cms.double(20.0)
@@ -0,0 +1,96 @@
+import FWCore.ParameterSet.Config as cms
+import argparse
+
+# Synthetic high-multiplicity benchmark of the ntuplizer, no input files needed.
+# Per-stage timing of analyze() is printed at the end of the job ("Stage timing")
+# and the peak memory by the SimpleMemoryCheck service.
+#   cmsRun Benchmark_runNtuplizer_cfg.py -nMuons 100 -nGenMuons 20 -decayDepth 3 -mode llp
+
+# Argument parser
+parser = argparse.ArgumentParser()
+parser.add_argument(
+    "-nMuons", type=int, default=10, help="Displaced muons per event (<= 200)."
+)
+parser.add_argument(
+    "-nGenMuons", type=int, default=10, help="Gen muons per event (<= 200)."
+)
+parser.add_argument(
+    "-decayDepth",
+    type=int,
+    default=1,
+    help="Intermediate copies between Z_d and the gen muon.",
+)
+parser.add_argument(
+    "-nEvents", type=int, default=1000, help="Number of events to process."
+)
+parser.add_argument(
+    "-mode", type=str, default="cosmics", choices=["cosmics", "llp"], help="Analyzer profile."
+)
+parser.add_argument(
+    "-surfaces", action="store_true", help="Also propagate the reco tracks to the surfaces."
+)
+parser.add_argument(
+    "-out_file",
+    type=str,
+    default="benchmark_ntuples.root",
+    help="Output file name for the ntuples.",
+)
+args = parser.parse_args()
+
+# The analyzer arrays hold 200 reco and 200 gen muons (kMaxGenMuons)
+if args.nMuons > 200:
+    raise ValueError("nMuons must be <= 200")
+if args.nGenMuons > 200:
+    raise ValueError("nGenMuons must be <= 200")
+
+process = cms.Process("BENCH")
+process.load("FWCore.MessageService.MessageLogger_cfi")
+process.MessageLogger.cerr.FwkReport.reportEvery = 1000
+process.load("MagneticField.Engine.uniformMagneticField_cfi")
+
+process.options = cms.untracked.PSet(wantSummary=cms.untracked.bool(True))
+process.SimpleMemoryCheck = cms.Service(
+    "SimpleMemoryCheck",
+    ignoreTotal=cms.untracked.int32(1),
+    moduleMemorySummary=cms.untracked.bool(True),
+)
+
+process.maxEvents = cms.untracked.PSet(input=cms.untracked.int32(args.nEvents))
+process.source = cms.Source("EmptySource")
+
+process.synthetic = cms.EDProducer(
+    "SyntheticMuonEventProducer",
+    nMuons=cms.uint32(args.nMuons),
+    nGenMuons=cms.uint32(args.nGenMuons),
+    decayDepth=cms.uint32(args.decayDepth),
+    seed=cms.uint32(12345),
+)
+
+## Define the process to run
+##
+process.load("DisplacedMuons-FrameWork-CosmicsAndLLP.Ntuplizer.Cosmics_ntuples_MiniAOD_cfi")
+
+# Uniform field, no magnetic or material volumes
+process.SteppingHelixPropagatorAlong.useMagVolumes = False
+process.SteppingHelixPropagatorAlong.useMatVolumes = False
+
+process.ntuples.nameOfOutput = args.out_file
+process.ntuples.isCosmics = args.mode == "cosmics"
+process.ntuples.computeTrackerPointing = args.mode == "cosmics"
+process.ntuples.displacedMuonCollection = cms.InputTag("synthetic")
+process.ntuples.prunedGenParticles = cms.InputTag("synthetic")
+process.ntuples.bits = cms.InputTag("TriggerResults", "", "BENCH")
+process.ntuples.timeStages = cms.bool(True)
+if args.surfaces:
+    import importlib
+
+    surfaces = importlib.import_module(
+        "DisplacedMuons-FrameWork-CosmicsAndLLP.Ntuplizer.PropagationSurfaces_cff"
+    )
+    process.ntuples.propagationSurfaces = surfaces.propagationSurfaces
+    process.ntuples.propagationMargin = surfaces.propagationMargin
+
+# The synthetic products are made in a path named as one of the HLTPaths_ of the analyzer,
+# so that the trigger matching runs as well
+process.HLT_L2Mu10_NoVertex_NoBPTX_v1 = cms.Path(process.synthetic)
+process.p = cms.EndPath(process.ntuples)
@@ -17,6 +17,13 @@ parser.add_argument(
 parser.add_argument(
     "-out_file", type=str, required=True, help="Output file name for the ntuples."
 )
+parser.add_argument(
+    "-layout",
+    type=str,
+    default="aligned",
+    choices=["aligned", "jagged"],
+    help="Output layout of the DSA/DGL/DTK track branches.",
+)
 args = parser.parse_args()
 main_dir = "/eos/home-m/mcrucian/datasets/"
 single_file = True if args.input.endswith(".root") else False
@@ -79,5 +86,6 @@ process.GlobalTag = GlobalTag(process.GlobalTag, gTag)
 process.load("DisplacedMuons-FrameWork-CosmicsAndLLP.Ntuplizer.Cosmics_ntuples_AOD_cfi")
 
 process.ntuples.nameOfOutput = args.out_file
+process.ntuples.outputLayout = cms.string(args.layout)
 
 process.p = cms.EndPath(process.ntuples)
@@ -13,6 +13,13 @@ parser.add_argument(
 parser.add_argument(
     "-out_file", type=str, required=True, help="Output file name for the ntuples."
 )
+parser.add_argument(
+    "-layout",
+    type=str,
+    default="aligned",
+    choices=["aligned", "jagged"],
+    help="Output layout of the DSA/DGL/DTK track branches.",
+)
 args = parser.parse_args()
 main_dir = "/eos/home-m/mcrucian/datasets/"
 single_file = True if args.input.endswith(".root") else False
@@ -75,5 +82,6 @@ process.load(
 )
 
 process.ntuples.nameOfOutput = args.out_file
+process.ntuples.outputLayout = cms.string(args.layout)
 
 process.p = cms.EndPath(process.ntuples)
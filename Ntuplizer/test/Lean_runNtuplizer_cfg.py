@@ -0,0 +1,121 @@
+import FWCore.ParameterSet.Config as cms
+import os
+import argparse
+
+# Ntuplizer job with the lean EventSetup (LeanSetup_cff) instead of the standard sequences,
+# for short test jobs and small shards. -setup full loads the standard sequences and the
+# global tag as the other runNtuplizer cfgs do, to compare the startup time
+# (runStartupBenchmark.sh).
+#   cmsRun Lean_runNtuplizer_cfg.py -profile cosmicsMiniAOD -input <in> -out_file ntuples.root
+
+# Analyzer configuration, input directory and global tag (full setup only) of every profile
+_profiles = {
+    "cosmicsAOD": (
+        "Cosmics_ntuples_AOD_cfi",
+        "/eos/home-m/mcrucian/datasets/",
+        "124X_dataRun3_Prompt_v10",
+    ),
+    "cosmicsMiniAOD": (
+        "Cosmics_ntuples_MiniAOD_cfi",
+        "/eos/home-m/mcrucian/displacedCosmicsMCMini/",
+        "124X_dataRun3_v15",
+    ),
+    "llp": (
+        "LLP_MC_ntuples_MiniAOD_cfi",
+        "/eos/home-m/mcrucian/datasets/",
+        "130X_mcRun3_2023_realistic_v14",
+    ),
+}
+
+# Argument parser
+parser = argparse.ArgumentParser()
+parser.add_argument(
+    "-input",
+    type=str,
+    required=True,
+    help="Either a .root file or a directory containing .root files to be processed.",
+)
+parser.add_argument(
+    "-out_file", type=str, required=True, help="Output file name for the ntuples."
+)
+parser.add_argument(
+    "-profile",
+    type=str,
+    default="cosmicsMiniAOD",
+    choices=_profiles.keys(),
+    help="Analyzer profile.",
+)
+parser.add_argument(
+    "-setup",
+    type=str,
+    default="lean",
+    choices=["lean", "full"],
+    help="EventSetup configuration.",
+)
+parser.add_argument(
+    "-trackerPointing",
+    action="store_true",
+    help="Fill passTrackerPointing of the cosmics MC gen muons (needs the propagator).",
+)
+parser.add_argument(
+    "-nEvents", type=int, default=-1, help="Number of events to process (-1 for all)."
+)
+args = parser.parse_args()
+cfi, main_dir, gTag = _profiles[args.profile]
+single_file = True if args.input.endswith(".root") else False
+
+process = cms.Process("demo")
+if args.setup == "lean":
+    process.load("DisplacedMuons-FrameWork-CosmicsAndLLP.Ntuplizer.LeanSetup_cff")
+else:
+    process.load("Configuration.StandardSequences.GeometryDB_cff")
+    process.load("Configuration.StandardSequences.MagneticField_38T_cff")
+    process.load("Configuration.StandardSequences.FrontierConditions_GlobalTag_cff")
+    process.load("Configuration.StandardSequences.Reconstruction_cff")
+    process.load("Configuration.StandardSequences.Services_cff")
+
+    from Configuration.AlCa.GlobalTag import GlobalTag
+
+    process.GlobalTag = GlobalTag(process.GlobalTag, gTag)
+
+# Debug printout and summary.
+process.load("FWCore.MessageService.MessageLogger_cfi")
+
+process.options = cms.untracked.PSet(wantSummary=cms.untracked.bool(True))
+
+process.maxEvents = cms.untracked.PSet(input=cms.untracked.int32(args.nEvents))
+
+# Read events
+if single_file:
+    # If a single file is provided, use it directly
+    listOfFiles = ["file:" + os.path.join(main_dir, args.input)]
+else:
+    # If a directory is provided, list all .root files in it
+    my_dir = os.path.join(main_dir, args.input)
+    if not os.path.isdir(my_dir):
+        raise ValueError(f"Provided input '{my_dir}' is not a valid directory.")
+
+    # Collect all .root files in the specified directory
+    listOfFiles = [
+        "file:" + os.path.join(my_dir, file)
+        for file in os.listdir(my_dir)
+        if file.endswith(".root")
+    ]
+    if not listOfFiles:
+        raise ValueError(f"No .root files found in the directory '{my_dir}'.")
+
+process.source = cms.Source(
+    "PoolSource",
+    fileNames=cms.untracked.vstring(listOfFiles),
+    secondaryFileNames=cms.untracked.vstring(),
+    skipEvents=cms.untracked.uint32(0),
+)
+
+## Define the process to run
+##
+process.load("DisplacedMuons-FrameWork-CosmicsAndLLP.Ntuplizer." + cfi)
+
+process.ntuples.nameOfOutput = args.out_file
+process.ntuples.computeTrackerPointing = cms.bool(args.trackerPointing)
+
+process.p = cms.EndPath(process.ntuples)
@@ -0,0 +1,108 @@
+import os
+import time
+import ROOT as R
+from argparse import ArgumentParser
+
+# Size and read time of the same sample ntuplized with the two output layouts:
+#   cmsRun Cosmics_runNtuplizer_AOD_cfg.py -input <in> -out_file a.root -layout aligned
+#   cmsRun Cosmics_runNtuplizer_AOD_cfg.py -input <in> -out_file j.root -layout jagged
+#   python3 compare_layouts.py --aligned a.root --jagged j.root
+# (LLP_MC_MiniAOD_runNtuplizer_cfg.py takes the same -layout option.)
+# The read times are the best of --repeat passes (warm file cache). The sum of the
+# DSA/DGL pt over the real tracks is computed from both files and must agree.
+
+R.gROOT.SetBatch(1)
+
+# Branch prefixes of every track type in the two layouts
+_prefixes = {
+    "aligned": {"dsa": "dmu_dsa_", "dgl": "dmu_dgl_", "dtk": "dmu_dtk_"},
+    "jagged": {"dsa": "dsa_", "dgl": "dgl_", "dtk": "dtk_"},
+}
+# Sum of the pt of the real tracks of every type
+_ptSums = {
+    "aligned": {
+        "dsa": "Sum(dmu_dsa_pt[dmu_isDSA == 1])",
+        "dgl": "Sum(dmu_dgl_pt[dmu_isDGL == 1])",
+    },
+    "jagged": {"dsa": "Sum(dsa_pt)", "dgl": "Sum(dgl_pt)"},
+}
+
+parser = ArgumentParser()
+parser.add_argument(
+    "--aligned", type=str, required=True, help="Ntuple with outputLayout aligned"
+)
+parser.add_argument(
+    "--jagged", type=str, required=True, help="Ntuple with outputLayout jagged"
+)
+parser.add_argument("--repeat", type=int, default=3, help="Number of timed passes")
+args = parser.parse_args()
+
+
+def branchBytes(tree, prefix):
+    """Compressed bytes of the branches starting with prefix."""
+    branches = tree.GetListOfBranches()
+    return sum(b.GetZipBytes() for b in branches if b.GetName().startswith(prefix))
+
+
+def best(function):
+    times = []
+    for _ in range(args.repeat):
+        start = time.perf_counter()
+        result = function()
+        times.append(time.perf_counter() - start)
+    return min(times), result
+
+
+def fullRead(tree):
+    tree.SetBranchStatus("*", 1)
+    for i in range(tree.GetEntries()):
+        tree.GetEntry(i)
+    return tree.GetEntries()
+
+
+def ptSums(fileName, layout):
+    df = R.RDataFrame("Events", fileName)
+    sums = {
+        t: df.Define("pt_" + t, e).Sum("pt_" + t) for t, e in _ptSums[layout].items()
+    }
+    return {t: s.GetValue() for t, s in sums.items()}
+
+
+results = {}
+for layout, fileName in (("aligned", args.aligned), ("jagged", args.jagged)):
+    f = R.TFile.Open(fileName)
+    tree = f.Get("Events")
+    result = {
+        "fileMB": os.path.getsize(fileName) / 1024.0**2,
+        "zipMB": tree.GetZipBytes() / 1024.0**2,
+        "totMB": tree.GetTotBytes() / 1024.0**2,
+        "nEntries": tree.GetEntries(),
+    }
+    for t, prefix in _prefixes[layout].items():
+        result[t + "MB"] = branchBytes(tree, prefix) / 1024.0**2
+    result["fullRead"], _ = best(lambda: fullRead(tree))
+    result["ptRead"], result["ptSums"] = best(lambda: ptSums(fileName, layout))
+    f.Close()
+    results[layout] = result
+
+rows = [
+    ("entries", "nEntries", "%12d"),
+    ("file [MB]", "fileMB", "%12.2f"),
+    ("Events zip [MB]", "zipMB", "%12.2f"),
+    ("Events tot [MB]", "totMB", "%12.2f"),
+    ("dsa zip [MB]", "dsaMB", "%12.2f"),
+    ("dgl zip [MB]", "dglMB", "%12.2f"),
+    ("dtk zip [MB]", "dtkMB", "%12.2f"),
+    ("full read [s]", "fullRead", "%12.3f"),
+    ("pt read [s]", "ptRead", "%12.3f"),
+]
+print("%-18s%12s%12s%12s" % ("", "aligned", "jagged", "ratio"))
+for label, key, fmt in rows:
+    a, j = results["aligned"][key], results["jagged"][key]
+    ratio = "%12.3f" % (j / a) if a else "%12s" % "-"
+    print("%-18s" % label + fmt % a + fmt % j + ratio)
+
+for t in ("dsa", "dgl"):
+    a, j = results["aligned"]["ptSums"][t], results["jagged"]["ptSums"][t]
+    status = "OK" if abs(a - j) <= 1e-6 * max(abs(a), 1.0) else "MISMATCH"
+    print("sum of %s pt: aligned %.6g jagged %.6g %s" % (t, a, j, status))
@@ -0,0 +1,50 @@
+import json
+import os
+import numpy as np
+from argparse import ArgumentParser
+
+# Zero-copy reader of the flat columnar export of the ntuplizer (columnarOutput parameter).
+# Only needs numpy: every column is a numpy.memmap of its .bin file, jagged columns
+# (dmu_*[ndmu], genmu_*[ngenmu]) come with the uint64 offsets of their counter so that
+# the values of entry i are values[offsets[i]:offsets[i + 1]].
+
+
+def load(directory):
+    """Return {column: array} and {counter: offsets} memory mapped from a tree directory."""
+    with open(os.path.join(directory, "schema.json")) as f:
+        schema = json.load(f)
+    nEntries = schema["nEntries"]
+    offsets = {}
+    for entry in schema["offsets"]:
+        offsets[entry["counter"]] = np.memmap(
+            os.path.join(directory, entry["file"]),
+            dtype=entry["dtype"],
+            mode="r",
+            shape=(nEntries + 1,),
+        )
+    columns = {}
+    for column in schema["columns"]:
+        nValues = column["nValues"]
+        if nValues == 0:
+            columns[column["name"]] = np.empty(0, dtype=column["dtype"])
+            continue
+        columns[column["name"]] = np.memmap(
+            os.path.join(directory, column["file"]),
+            dtype=column["dtype"],
+            mode="r",
+            shape=(nValues,),
+        )
+    return schema, columns, offsets
+
+
+if __name__ == "__main__":
+    parser = ArgumentParser()
+    parser.add_argument("directory", type=str, help="Tree directory, e.g. columnar/Events")
+    args = parser.parse_args()
+
+    schema, columns, offsets = load(args.directory)
+    print(f"{schema['tree']}: {schema['nEntries']} entries, {len(columns)} columns")
+    for column in schema["columns"]:
+        values = columns[column["name"]]
+        counter = column["counter"] or ""
+        print(f"  {column['name']:<40} {column['dtype']:<5} {counter:<8} {len(values)} values")
@@ -0,0 +1,38 @@
+#!/bin/bash
+# Scaling benchmark of the ntuplizer with synthetic events.
+# Usage: ./runBenchmark.sh [mode] [nEvents] [decayDepth]
+#   mode: cosmics (tag and probe, O(N^2)) or llp (gen matching, O(N_reco x N_gen x depth))
+# For every multiplicity the per-stage time per event and the peak RSS are reported.
+cmsenv
+
+mode=${1:-cosmics}
+nEvents=${2:-1000}
+decayDepth=${3:-3}
+multiplicities="2 5 10 25 50 100 150 200"
+
+summary="benchmark_${mode}.txt"
+printf "%-8s %-8s %-12s %-12s %-12s %-12s %-12s %-12s\n" \
+    "nMuons" "nGen" "genMatch[us]" "muons[us]" "T&P[us]" "fill[us]" "total[us]" "peakRSS[MB]" > ${summary}
+
+for nMuons in ${multiplicities}; do
+    # N_gen is scanned with N_reco, so that the gen matching shows its N_reco x N_gen scaling
+    nGen=${nMuons}
+    logfile="benchmark_${mode}_${nMuons}.log"
+    echo "Running ${mode} benchmark with ${nMuons} muons and ${nGen} gen muons"
+
+    /usr/bin/time -f "peakRSS %M" cmsRun Benchmark_runNtuplizer_cfg.py -mode ${mode} \
+        -nMuons ${nMuons} -nGenMuons ${nGen} -decayDepth ${decayDepth} -nEvents ${nEvents} \
+        -out_file benchmark_${mode}_${nMuons}.root &> ${logfile}
+
+    # "<stage> <total [s]> <per event [us]>" lines of the stage report
+    stage() { awk -v s="$1" '$1 == s && NF == 3 {print $3}' ${logfile}; }
+    total=0
+    for s in setup genMatching cosmicsGen muons overlap propagation tagAndProbe trigger fill; do
+        total=$(awk -v t="${total}" -v x="$(stage ${s})" 'BEGIN {print t + x}')
+    done
+    rss=$(awk '/^peakRSS/ {printf "%.1f", $2 / 1024}' ${logfile})
+    printf "%-8s %-8s %-12s %-12s %-12s %-12s %-12s %-12s\n" ${nMuons} ${nGen} \
+        "$(stage genMatching)" "$(stage muons)" "$(stage tagAndProbe)" "$(stage fill)" "${total}" "${rss}" >> ${summary}
+done
+
+cat ${summary}
@@ -0,0 +1,35 @@
+#!/bin/bash
+# Startup benchmark of the full (standard sequences + global tag) and lean (LeanSetup_cff)
+# EventSetup configurations. Every job processes a single event, so the wall time is dominated
+# by the configuration, module construction and EventSetup initialisation.
+# Usage: ./runStartupBenchmark.sh <input> [profile] [nRepeat]
+#   profile: cosmicsAOD, cosmicsMiniAOD or llp (see Lean_runNtuplizer_cfg.py)
+cmsenv
+
+input=${1:?"usage: $0 <input> [profile] [nRepeat]"}
+profile=${2:-cosmicsMiniAOD}
+nRepeat=${3:-3}
+
+summary="startup_${profile}.txt"
+printf "%-8s %-8s %-12s %-12s\n" "setup" "run" "wall[s]" "peakRSS[MB]" > ${summary}
+
+for setup in full lean; do
+    for irun in $(seq 1 ${nRepeat}); do
+        logfile="startup_${profile}_${setup}_${irun}.log"
+        echo "Running ${profile} with the ${setup} setup (${irun}/${nRepeat})"
+
+        /usr/bin/time -f "wallTime %e peakRSS %M" cmsRun Lean_runNtuplizer_cfg.py \
+            -profile ${profile} -setup ${setup} -input ${input} -nEvents 1 \
+            -out_file startup_${profile}_${setup}.root &> ${logfile}
+
+        wall=$(awk '/^wallTime/ {print $2}' ${logfile})
+        rss=$(awk '/^wallTime/ {printf "%.1f", $4 / 1024}' ${logfile})
+        printf "%-8s %-8s %-12s %-12s\n" ${setup} ${irun} "${wall}" "${rss}" >> ${summary}
+    done
+done
+
+# Mean wall time of every setup (the first run also warms the file and conditions caches)
+awk 'NR > 1 {sum[$1] += $3; n[$1]++} END {for (s in sum) printf "%-8s mean wall %.2f s\n", s, sum[s] / n[s]}' \
+    ${summary} >> ${summary}
+
+cat ${summary}